@@ -0,0 +1,457 @@
+// Host throughput benchmark of the simulator (make bench).
+// Runs a fixed suite with the core / bus traces on and off, in process
+// through the simulator library (see simulator.h), and reports per run:
+//   cycles, instructions  simulated work (both fixed for a given tree)
+//   load_ms               sim_create() + sim_load()
+//   simulate_ms           sim_step() until the run is over
+//   output_ms             traces closed and output files written (sim_run())
+//   cycles_per_s          simulated cycles per host second of simulate_ms
+//   peak_rss_kb           peak resident memory of the run (see sim_peak_memory_kb())
+// The suite is the shipped programs (counter, mulserial, mulparallel, read
+// from the --programs dir as imem .txt or .asm) and generated workloads,
+// written to the work dir: matmul (32x32, row-partitioned), pointer_chase (a
+// random cycle of blocks, every hop a miss), sharing (one block, every core
+// writes a word of its own and a shared counter) and stream (a[i] + 1 -> b[i]
+// over private arrays). --scale N makes the generated ones N times longer.
+//
+// usage: bench [--scale N] [--threads N] [--programs dir] [--baseline file]
+//              [--tolerance percent] <work dir>
+// Results go to <work dir>/results.txt, one line per run in a fixed order.
+// With --baseline (an earlier results.txt) every run is compared with it: a
+// run whose cycles or instructions changed, or whose cycles_per_s dropped
+// by more than the tolerance (default 10%), is a regression and the exit
+// status is 1.
+
+#include "../sim/simulator.h"
+#include "../sim/hex_io.h"
+#include "../sim/sim_thread.h"
+#include <stdarg.h>
+
+#define BENCH_MAX_CYCLES "200000000"
+#define BENCH_PATH_MAX 1024
+#define BENCH_MAX_RUNS 64
+
+#define R_ZERO 0
+#define R_IMM 1
+
+typedef struct {
+    uint32_t words[IMEM_DEPTH];
+    int count;
+} Program;
+
+// The inputs of a generated workload: one program per core and main memory
+typedef struct {
+    Program programs[CORE_COUNT];
+    uint32_t* memory; // MEMIN_DEPTH words
+} Workload;
+
+typedef struct {
+    char workload[64];
+    char trace[8];          // "on" / "off"
+    long long cycles;
+    long long instructions;
+    double load_ms;
+    double simulate_ms;
+    double output_ms;
+    long long cycles_per_s;
+    long long peak_rss_kb;
+} BenchRun;
+
+typedef void (*WorkloadGenerator)(Workload* workload, int scale);
+
+static void emit(Program* p, Opcode op, int rd, int rs, int rt, int imm) {
+    p->words[p->count++] = ((uint32_t)op << 24) | ((uint32_t)rd << 20) | ((uint32_t)rs << 16) |
+                           ((uint32_t)rt << 12) | ((uint32_t)imm & 0xFFF);
+}
+
+static void emit_nop(Program* p) {
+    emit(p, OP_ADD, R_ZERO, R_ZERO, R_ZERO, 0);
+}
+
+// reg = value, for values below 2^21
+static void load_const(Program* p, int reg, int value) {
+    if (value >= -2048 && value < 2048) {
+        emit(p, OP_ADD, reg, R_ZERO, R_IMM, value);
+        return;
+    }
+    emit(p, OP_ADD, reg, R_ZERO, R_IMM, value >> 10);
+    emit(p, OP_SLL, reg, reg, R_IMM, 10);
+    emit(p, OP_ADD, reg, reg, R_IMM, value & 0x3FF);
+}
+
+// Branch back to target if the condition on rs, rt holds, with a nop in the delay slot
+static void branch_back(Program* p, Opcode op, int rs, int rt, int target) {
+    emit(p, op, R_IMM, rs, rt, target);
+    emit_nop(p);
+}
+
+// C = A x B for 32x32 matrices, core c computes rows 8c..8c+7, scale times over
+#define MATMUL_N 32
+#define MATMUL_LOG_N 5
+#define MATMUL_A 0x10000
+#define MATMUL_B (MATMUL_A + MATMUL_N * MATMUL_N)
+#define MATMUL_C (MATMUL_B + MATMUL_N * MATMUL_N)
+
+static void generate_matmul(Workload* workload, int scale) {
+    for (int i = 0; i < MATMUL_N * MATMUL_N; i++) {
+        workload->memory[MATMUL_A + i] = (uint32_t)(i % 7 + 1);
+        workload->memory[MATMUL_B + i] = (uint32_t)(i % 5 + 1);
+    }
+    int rows = MATMUL_N / CORE_COUNT;
+    for (int c = 0; c < CORE_COUNT; c++) {
+        // r2 = i, r3 = j, r4 = k, r5..r7 = A, B, C, r8 = sum, r9..r12 temps,
+        // r13 = N, r14 = last row + 1, r15 = repetitions left
+        Program* p = &workload->programs[c];
+        load_const(p, 5, MATMUL_A);
+        load_const(p, 6, MATMUL_B);
+        load_const(p, 7, MATMUL_C);
+        load_const(p, 13, MATMUL_N);
+        load_const(p, 15, scale);
+        int rep = p->count;
+        load_const(p, 2, c * rows);
+        load_const(p, 14, (c + 1) * rows);
+        int loop_i = p->count;
+        emit(p, OP_ADD, 3, R_ZERO, R_ZERO, 0);
+        int loop_j = p->count;
+        emit(p, OP_ADD, 4, R_ZERO, R_ZERO, 0);
+        emit(p, OP_ADD, 8, R_ZERO, R_ZERO, 0);
+        int loop_k = p->count;
+        emit(p, OP_SLL, 9, 2, R_IMM, MATMUL_LOG_N);  // A[i][k]
+        emit(p, OP_ADD, 9, 9, 4, 0);
+        emit(p, OP_LW, 10, 9, 5, 0);
+        emit(p, OP_SLL, 9, 4, R_IMM, MATMUL_LOG_N);  // B[k][j]
+        emit(p, OP_ADD, 9, 9, 3, 0);
+        emit(p, OP_LW, 11, 9, 6, 0);
+        emit(p, OP_MUL, 12, 10, 11, 0);
+        emit(p, OP_ADD, 8, 8, 12, 0);
+        emit(p, OP_ADD, 4, 4, R_IMM, 1);
+        branch_back(p, OP_BLT, 4, 13, loop_k);
+        emit(p, OP_SLL, 9, 2, R_IMM, MATMUL_LOG_N);  // C[i][j]
+        emit(p, OP_ADD, 9, 9, 3, 0);
+        emit(p, OP_ADD, 9, 9, 7, 0);
+        emit(p, OP_SW, 8, 9, R_ZERO, 0);
+        emit(p, OP_ADD, 3, 3, R_IMM, 1);
+        branch_back(p, OP_BLT, 3, 13, loop_j);
+        emit(p, OP_ADD, 2, 2, R_IMM, 1);
+        branch_back(p, OP_BLT, 2, 14, loop_i);
+        emit(p, OP_SUB, 15, 15, R_IMM, 1);
+        branch_back(p, OP_BNE, 15, R_ZERO, rep);
+        emit(p, OP_HALT, 0, 0, 0, 0);
+    }
+}
+
+// A random cycle through 4096 blocks, each core starts a quarter apart
+#define CHASE_BASE 0x20000
+#define CHASE_NODES 4096
+#define CHASE_HOPS 4096
+
+static void generate_pointer_chase(Workload* workload, int scale) {
+    int* order = (int*)malloc(CHASE_NODES * sizeof(int));
+    if (!order) return;
+    for (int i = 0; i < CHASE_NODES; i++) order[i] = i;
+    uint32_t random = 12345;
+    for (int i = CHASE_NODES - 1; i > 0; i--) {
+        random = random * 1103515245u + 12345u;
+        int j = (int)((random >> 8) % (uint32_t)(i + 1));
+        int swap = order[i];
+        order[i] = order[j];
+        order[j] = swap;
+    }
+    for (int i = 0; i < CHASE_NODES; i++) {
+        uint32_t node = CHASE_BASE + (uint32_t)order[i] * CACHE_BLOCK_SIZE;
+        workload->memory[node] = CHASE_BASE + (uint32_t)order[(i + 1) % CHASE_NODES] * CACHE_BLOCK_SIZE;
+    }
+
+    for (int c = 0; c < CORE_COUNT; c++) {
+        // r2 = node, r3 = hops left
+        Program* p = &workload->programs[c];
+        load_const(p, 2, CHASE_BASE + order[c * CHASE_NODES / CORE_COUNT] * CACHE_BLOCK_SIZE);
+        load_const(p, 3, CHASE_HOPS * scale);
+        int loop = p->count;
+        emit(p, OP_LW, 2, 2, R_ZERO, 0);
+        emit(p, OP_SUB, 3, 3, R_IMM, 1);
+        branch_back(p, OP_BNE, 3, R_ZERO, loop);
+        emit(p, OP_HALT, 0, 0, 0, 0);
+    }
+    free(order);
+}
+
+// Word 0 of the block is a counter every core increments, word 1 + c core c's own
+#define SHARING_BASE 0x30000
+#define SHARING_ITERATIONS 2048
+
+static void generate_sharing(Workload* workload, int scale) {
+    for (int c = 0; c < CORE_COUNT; c++) {
+        // r2 = block, r3 = iterations left, r4, r5 temps
+        Program* p = &workload->programs[c];
+        load_const(p, 2, SHARING_BASE);
+        load_const(p, 3, SHARING_ITERATIONS * scale);
+        int loop = p->count;
+        emit(p, OP_LW, 4, 2, R_IMM, 1 + c);
+        emit(p, OP_ADD, 4, 4, R_IMM, 1);
+        emit(p, OP_SW, 4, 2, R_IMM, 1 + c);
+        emit(p, OP_LW, 5, 2, R_ZERO, 0);
+        emit(p, OP_ADD, 5, 5, R_IMM, 1);
+        emit(p, OP_SW, 5, 2, R_ZERO, 0);
+        emit(p, OP_SUB, 3, 3, R_IMM, 1);
+        branch_back(p, OP_BNE, 3, R_ZERO, loop);
+        emit(p, OP_HALT, 0, 0, 0, 0);
+    }
+}
+
+// b[i] = a[i] + 1 over 4096 words per core, a and b private to the core
+#define STREAM_BASE 0x40000
+#define STREAM_WORDS 4096
+
+static void generate_stream(Workload* workload, int scale) {
+    int words = STREAM_WORDS * scale;
+    for (int c = 0; c < CORE_COUNT; c++) {
+        int a = STREAM_BASE + c * 2 * words;
+        for (int i = 0; i < words; i++) workload->memory[a + i] = (uint32_t)i;
+
+        // r2 = &a[i], r3 = &b[i], r4 = end of a, r5 temp
+        Program* p = &workload->programs[c];
+        load_const(p, 2, a);
+        load_const(p, 3, a + words);
+        load_const(p, 4, a + words);
+        int loop = p->count;
+        emit(p, OP_LW, 5, 2, R_ZERO, 0);
+        emit(p, OP_ADD, 5, 5, R_IMM, 1);
+        emit(p, OP_SW, 5, 3, R_ZERO, 0);
+        emit(p, OP_ADD, 2, 2, R_IMM, 1);
+        emit(p, OP_ADD, 3, 3, R_IMM, 1);
+        branch_back(p, OP_BLT, 2, 4, loop);
+        emit(p, OP_HALT, 0, 0, 0, 0);
+    }
+}
+
+typedef struct {
+    const char* name;
+    WorkloadGenerator generate; // NULL: a shipped program, read from --programs
+} BenchWorkload;
+
+static const BenchWorkload bench_suite[] = {
+    { "counter", NULL },
+    { "mulserial", NULL },
+    { "mulparallel", NULL },
+    { "matmul", generate_matmul },
+    { "pointer_chase", generate_pointer_chase },
+    { "sharing", generate_sharing },
+    { "stream", generate_stream },
+};
+#define BENCH_SUITE_SIZE (sizeof(bench_suite) / sizeof(bench_suite[0]))
+
+// path = the formatted string, false (and an error) if it does not fit
+static bool bench_path(char* path, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(path, BENCH_PATH_MAX, format, args);
+    va_end(args);
+    if (length >= 0 && length < BENCH_PATH_MAX) return true;
+    printf("%.64s...: path too long\n", path);
+    return false;
+}
+
+static bool file_exists(const char* path) {
+    FILE* file = fopen(path, "r");
+    if (!file) return false;
+    fclose(file);
+    return true;
+}
+
+// Write the imem files and memin of a generated workload to dir
+static bool write_workload(const char* dir, WorkloadGenerator generate, int scale) {
+    Workload* workload = (Workload*)calloc(1, sizeof(Workload));
+    uint32_t* memory = (uint32_t*)calloc(MEMIN_DEPTH, sizeof(uint32_t));
+    bool ok = workload && memory && sim_make_dir(dir);
+    char path[BENCH_PATH_MAX];
+    if (ok) {
+        workload->memory = memory;
+        generate(workload, scale);
+        for (int c = 0; ok && c < CORE_COUNT; c++) {
+            ok = bench_path(path, "%s/imem%d.txt", dir, c) &&
+                 write_hex_file(path, workload->programs[c].words, (size_t)workload->programs[c].count, 1);
+        }
+        ok = ok && bench_path(path, "%s/memin.txt", dir) &&
+             write_hex_file(path, memory, hex_trimmed_length(memory, MEMIN_DEPTH), sim_cpu_count());
+    }
+    if (!ok) printf("%s: could not write the workload\n", dir);
+    free(memory);
+    free(workload);
+    return ok;
+}
+
+// Traces are only written to be timed, they would fill the disk
+static void remove_traces(const char* dir) {
+    char path[BENCH_PATH_MAX];
+    for (int c = 0; c < CORE_COUNT; c++) {
+        if (bench_path(path, "%s/core%dtrace.txt", dir, c)) remove(path);
+    }
+    if (bench_path(path, "%s/bustrace.txt", dir)) remove(path);
+}
+
+static bool run_one(const char* name, const char* input_dir, const char* output_dir, bool trace,
+                    const char* threads, BenchRun* run) {
+    char* argv[] = { "--max-cycles", BENCH_MAX_CYCLES, "--threads", (char*)threads, "--no-trace" };
+    int argc = trace ? 4 : 5;
+    memset(run, 0, sizeof(*run));
+    snprintf(run->workload, sizeof(run->workload), "%s", name);
+    snprintf(run->trace, sizeof(run->trace), "%s", trace ? "on" : "off");
+    if (!sim_make_dir(output_dir)) {
+        perror(output_dir);
+        return false;
+    }
+
+    SimConfig config;
+    SimFiles files;
+    SimOptions options;
+    sim_reset_peak_memory();
+    double start = sim_wall_time();
+    if (!parse_arguments(argc, argv, input_dir, output_dir, &config, &files, &options)) {
+        free_files(&files);
+        return false;
+    }
+    Simulator* sim = sim_create(&config, &options);
+    if (!sim) {
+        free_files(&files);
+        return false;
+    }
+    if (!sim_load(sim, &files)) {
+        sim_destroy(sim);
+        return false;
+    }
+    double loaded = sim_wall_time();
+    while (sim_step(sim)) {}
+    double simulated = sim_wall_time();
+    sim_run(sim);
+    double written = sim_wall_time();
+
+    run->cycles = sim->cycle;
+    for (int c = 0; c < sim->context.config.core_count; c++) run->instructions += sim->cores[c]->stats.instructions;
+    run->load_ms = (loaded - start) * 1000.0;
+    run->simulate_ms = (simulated - loaded) * 1000.0;
+    run->output_ms = (written - simulated) * 1000.0;
+    run->cycles_per_s = simulated > loaded ? (long long)((double)run->cycles / (simulated - loaded)) : 0;
+    run->peak_rss_kb = sim_peak_memory_kb();
+    bool ok = !sim->timed_out;
+    if (!ok) printf("%s: no HALT within %s cycles\n", name, BENCH_MAX_CYCLES);
+    sim_destroy(sim);
+    remove_traces(output_dir);
+    return ok;
+}
+
+static void print_run(FILE* out, const BenchRun* run) {
+    fprintf(out, "%s %s %lld %lld %.1f %.1f %.1f %lld %lld\n", run->workload, run->trace, run->cycles,
+        run->instructions, run->load_ms, run->simulate_ms, run->output_ms, run->cycles_per_s, run->peak_rss_kb);
+}
+
+#define BENCH_HEADER "workload trace cycles instructions load_ms simulate_ms output_ms cycles_per_s peak_rss_kb\n"
+
+// Compare runs with the results file at path, returns the number of regressions
+static int compare_baseline(const char* path, const BenchRun* runs, int count, double tolerance) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        perror(path);
+        return 1;
+    }
+    int regressions = 0;
+    char line[512];
+    bool* seen = (bool*)calloc((size_t)count, sizeof(bool));
+    while (seen && fgets(line, sizeof(line), file)) {
+        BenchRun base;
+        if (line[0] == '#' || sscanf(line, "%63s %7s %lld %lld %lf %lf %lf %lld %lld", base.workload, base.trace,
+                &base.cycles, &base.instructions, &base.load_ms, &base.simulate_ms, &base.output_ms,
+                &base.cycles_per_s, &base.peak_rss_kb) != 9) continue;
+        for (int i = 0; i < count; i++) {
+            const BenchRun* run = &runs[i];
+            if (strcmp(run->workload, base.workload) != 0 || strcmp(run->trace, base.trace) != 0) continue;
+            seen[i] = true;
+            double ratio = base.cycles_per_s > 0 ? (double)run->cycles_per_s / (double)base.cycles_per_s : 1.0;
+            const char* verdict = "ok";
+            if (run->cycles != base.cycles || run->instructions != base.instructions) verdict = "CHANGED";
+            else if (ratio < 1.0 - tolerance / 100.0) verdict = "SLOWER";
+            if (strcmp(verdict, "ok") != 0) regressions++;
+            printf("%-14s trace %-3s %6.2fx cycles_per_s  %s\n", run->workload, run->trace, ratio, verdict);
+        }
+    }
+    for (int i = 0; seen && i < count; i++) {
+        if (!seen[i]) printf("%-14s trace %-3s not in %s\n", runs[i].workload, runs[i].trace, path);
+    }
+    free(seen);
+    fclose(file);
+    return regressions;
+}
+
+int main(int argc, char** argv) {
+    int scale = 1;
+    const char* threads = "1";
+    const char* programs = ".";
+    const char* baseline = NULL;
+    const char* work_dir = NULL;
+    double tolerance = 10.0;
+    bool usage = false;
+    for (int i = 1; i < argc && !usage; i++) {
+        if (strcmp(argv[i], "--scale") == 0 && i + 1 < argc) scale = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) threads = argv[++i];
+        else if (strcmp(argv[i], "--programs") == 0 && i + 1 < argc) programs = argv[++i];
+        else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) baseline = argv[++i];
+        else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc) tolerance = atof(argv[++i]);
+        else if (argv[i][0] != '-' && !work_dir) work_dir = argv[i];
+        else usage = true;
+    }
+    // Stream arrays of every core have to fit in main memory
+    if (usage || !work_dir || scale < 1 || STREAM_BASE + 2 * CORE_COUNT * STREAM_WORDS * scale > MEMIN_DEPTH) {
+        printf("usage: %s [--scale N] [--threads N] [--programs dir] [--baseline file] "
+               "[--tolerance percent] <work dir>\n", argv[0]);
+        return 1;
+    }
+
+    BenchRun runs[BENCH_MAX_RUNS];
+    int count = 0;
+    int failed = 0;
+    char input_dir[BENCH_PATH_MAX];
+    char output_dir[BENCH_PATH_MAX];
+    char path[BENCH_PATH_MAX];
+    printf(BENCH_HEADER);
+    for (size_t w = 0; w < BENCH_SUITE_SIZE; w++) {
+        const BenchWorkload* workload = &bench_suite[w];
+        if (workload->generate) {
+            if (!bench_path(input_dir, "%s/%s", work_dir, workload->name) ||
+                !write_workload(input_dir, workload->generate, scale)) {
+                failed++;
+                continue;
+            }
+        } else {
+            if (!bench_path(input_dir, "%s/%s", programs, workload->name) ||
+                !bench_path(path, "%s/imem0.txt", input_dir) ||
+                (!file_exists(path) && (!bench_path(path, "%s/imem0.asm", input_dir) || !file_exists(path)))) {
+                printf("%s: no imem0.txt or imem0.asm in %s, skipped\n", workload->name, input_dir);
+                continue;
+            }
+        }
+        for (int trace = 1; trace >= 0; trace--) {
+            if (bench_path(output_dir, "%s/%s/trace_%s", work_dir, workload->name, trace ? "on" : "off") &&
+                run_one(workload->name, input_dir, output_dir, trace != 0, threads, &runs[count])) {
+                print_run(stdout, &runs[count++]);
+                fflush(stdout);
+            } else {
+                printf("%s: trace %s failed\n", workload->name, trace ? "on" : "off");
+                failed++;
+            }
+        }
+    }
+
+    FILE* results = bench_path(path, "%s/results.txt", work_dir) ? fopen(path, "w") : NULL;
+    if (!results) {
+        perror(path);
+        return 1;
+    }
+    fprintf(results, "# bench scale %d threads %s\n", scale, threads);
+    fprintf(results, BENCH_HEADER);
+    for (int i = 0; i < count; i++) print_run(results, &runs[i]);
+    fclose(results);
+    printf("Results: %s\n", path);
+
+    if (baseline && compare_baseline(baseline, runs, count, tolerance) > 0) failed++;
+    return failed > 0 ? 1 : 0;
+}
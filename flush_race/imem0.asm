@@ -0,0 +1,10 @@
+add $r2, $zero, $imm, 1      # Value to store
+add $r4, $zero, $imm, 8      # Words left
+sw $r2, $r4, $imm, -1        # Store to word r4 - 1 of block 0
+add $r2, $r2, $imm, 1
+sub $r4, $r4, $imm, 1
+bne $imm, $r4, $zero, 2
+add $r0, $r0, $r0, 0
+add $r9, $zero, $imm, 512    # Conflict miss: write block 0 back
+lw $zero, $r9, $imm, 0
+halt $zero, $zero, $zero, 0
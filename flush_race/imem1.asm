@@ -0,0 +1,6 @@
+add $r2, $zero, $imm, 3      # Short wait, the read lands mid-stores
+sub $r2, $r2, $imm, 1
+bne $imm, $r2, $zero, 1
+add $r0, $r0, $r0, 0
+lw $r3, $zero, $imm, 0       # BusRd: core 0 flushes block 0 while storing to it
+halt $zero, $zero, $zero, 0
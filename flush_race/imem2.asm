@@ -0,0 +1 @@
+halt $zero, $zero, $zero, 0
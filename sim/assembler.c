@@ -0,0 +1,287 @@
+#include "assembler.h"
+#include <ctype.h>
+#include <stdarg.h>
+
+#define IMM_MIN (-2048)
+#define IMM_MAX 4095 // 0xFFF, the immediate is sign extended either way
+
+static const struct {
+    const char* name;
+    Opcode opcode;
+} opcodes[] = {
+    { "add", OP_ADD }, { "sub", OP_SUB }, { "and", OP_AND }, { "or", OP_OR },
+    { "xor", OP_XOR }, { "mul", OP_MUL }, { "sll", OP_SLL }, { "sra", OP_SRA },
+    { "srl", OP_SRL }, { "beq", OP_BEQ }, { "bne", OP_BNE }, { "blt", OP_BLT },
+    { "bgt", OP_BGT }, { "ble", OP_BLE }, { "bge", OP_BGE }, { "jal", OP_JAL },
+    { "lw", OP_LW }, { "sw", OP_SW }, { "halt", OP_HALT },
+};
+#define OPCODE_COUNT (sizeof(opcodes) / sizeof(opcodes[0]))
+
+typedef struct {
+    char name[ASM_LABEL_MAX];
+    long pc;
+    int line;
+} Label;
+
+// One source file being assembled
+typedef struct {
+    const char* path;
+    int line;       // Current line, for the messages
+    int errors;
+    Label* labels;
+    int label_count;
+    int label_capacity;
+} Assembly;
+
+static void asm_error(Assembly* as, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    printf("%s:%d: ", as->path, as->line);
+    vprintf(format, args);
+    printf("\n");
+    va_end(args);
+    as->errors++;
+}
+
+bool is_asm_file(const char* path) {
+    size_t len = strlen(path);
+    return len >= 4 && strcmp(path + len - 4, ".asm") == 0;
+}
+
+// The whole file, NUL terminated, NULL if it cannot be read
+static char* read_source(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (!file) return NULL;
+    char* text = NULL;
+    long size = fseek(file, 0, SEEK_END) == 0 ? ftell(file) : -1;
+    if (size >= 0 && fseek(file, 0, SEEK_SET) == 0) text = (char*)malloc((size_t)size + 1);
+    if (text && fread(text, 1, (size_t)size, file) != (size_t)size) {
+        free(text);
+        text = NULL;
+    }
+    if (text) text[size] = '\0';
+    fclose(file);
+    return text;
+}
+
+static char* skip_space(char* s) {
+    while (*s == ' ' || *s == '\t' || *s == '\r') s++;
+    return s;
+}
+
+static bool is_name_start(char c) {
+    return isalpha((unsigned char)c) || c == '_';
+}
+
+static char* skip_name(char* s) {
+    while (isalnum((unsigned char)*s) || *s == '_') s++;
+    return s;
+}
+
+static const Label* find_label(const Assembly* as, const char* name) {
+    for (int i = 0; i < as->label_count; i++) {
+        if (strcmp(as->labels[i].name, name) == 0) return &as->labels[i];
+    }
+    return NULL;
+}
+
+static void define_label(Assembly* as, const char* name, long pc) {
+    const Label* defined = find_label(as, name);
+    if (defined) {
+        asm_error(as, "label '%s' already defined on line %d", name, defined->line);
+        return;
+    }
+    if (as->label_count == as->label_capacity) {
+        int capacity = as->label_capacity ? 2 * as->label_capacity : 32;
+        Label* labels = (Label*)realloc(as->labels, (size_t)capacity * sizeof(Label));
+        if (!labels) {
+            asm_error(as, "out of memory");
+            return;
+        }
+        as->labels = labels;
+        as->label_capacity = capacity;
+    }
+    Label* label = &as->labels[as->label_count++];
+    strcpy(label->name, name);
+    label->pc = pc;
+    label->line = as->line;
+}
+
+// Strips the comment and the labels off line, defining the labels at pc.
+// Returns the statement left, NULL if there is none.
+static char* strip_line(Assembly* as, char* line, long pc) {
+    char* comment = strchr(line, '#');
+    if (comment) *comment = '\0';
+    char* s = skip_space(line);
+    while (is_name_start(*s)) {
+        char* end = skip_name(s);
+        char* colon = skip_space(end);
+        if (*colon != ':') break;
+        *end = '\0';
+        if (end - s >= ASM_LABEL_MAX) asm_error(as, "label '%.16s...' longer than %d characters", s, ASM_LABEL_MAX - 1);
+        else define_label(as, s, pc);
+        s = skip_space(colon + 1);
+    }
+    return *s ? s : NULL;
+}
+
+// Trims the spaces around an operand in place
+static char* trim(char* s) {
+    s = skip_space(s);
+    char* end = s + strlen(s);
+    while (end > s && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r')) end--;
+    *end = '\0';
+    return s;
+}
+
+static bool equals_ignore_case(const char* a, const char* b) {
+    for (; *a && *b; a++, b++) {
+        if (tolower((unsigned char)*a) != tolower((unsigned char)*b)) return false;
+    }
+    return *a == *b;
+}
+
+static int parse_register(Assembly* as, const char* operand) {
+    if (equals_ignore_case(operand, "$zero")) return 0;
+    if (equals_ignore_case(operand, "$imm")) return 1;
+    if (operand[0] == '$' && (operand[1] == 'r' || operand[1] == 'R') && isdigit((unsigned char)operand[2])) {
+        char* end;
+        long reg = strtol(operand + 2, &end, 10);
+        if (*end == '\0' && reg < 16) return (int)reg;
+    }
+    asm_error(as, "bad register '%s', expected $r0..$r15, $zero or $imm", operand);
+    return 0;
+}
+
+static int32_t parse_immediate(Assembly* as, const char* operand) {
+    long value;
+    if (is_name_start(operand[0])) {
+        const Label* label = find_label(as, operand);
+        if (!label) {
+            asm_error(as, "unknown label '%s'", operand);
+            return 0;
+        }
+        value = label->pc;
+    } else {
+        const char* digits = operand[0] == '-' || operand[0] == '+' ? operand + 1 : operand;
+        bool hex = digits[0] == '0' && (digits[1] == 'x' || digits[1] == 'X');
+        char* end = NULL;
+        if (hex ? isxdigit((unsigned char)digits[2]) : isdigit((unsigned char)digits[0])) {
+            value = strtol(hex ? digits + 2 : digits, &end, hex ? 16 : 10);
+            if (operand[0] == '-') value = -value;
+        }
+        if (!end || *end != '\0') {
+            asm_error(as, "bad immediate '%s', expected a number or a label", operand);
+            return 0;
+        }
+    }
+    if (value < IMM_MIN || value > IMM_MAX) {
+        asm_error(as, "immediate '%s' does not fit in 12 bits (%d..%d)", operand, IMM_MIN, IMM_MAX);
+        return 0;
+    }
+    return (int32_t)value;
+}
+
+// "opcode rd, rs, rt, imm" into word
+static uint32_t encode_statement(Assembly* as, char* statement) {
+    char* end = skip_name(statement);
+    char mnemonic[8] = "";
+    if (end - statement < (long)sizeof(mnemonic)) {
+        memcpy(mnemonic, statement, (size_t)(end - statement));
+        mnemonic[end - statement] = '\0';
+    }
+    int op = -1;
+    for (size_t i = 0; i < OPCODE_COUNT; i++) {
+        if (equals_ignore_case(mnemonic, opcodes[i].name)) op = (int)i;
+    }
+    if (op < 0 || (*end && *end != ' ' && *end != '\t' && *end != '\r')) {
+        char* space = statement;
+        while (*space && *space != ' ' && *space != '\t') space++;
+        *space = '\0';
+        asm_error(as, "unknown opcode '%s'", statement);
+        return 0;
+    }
+
+    char* operands[4];
+    int count = 0;
+    char* s = end;
+    for (;;) {
+        char* comma = strchr(s, ',');
+        if (comma) *comma = '\0';
+        if (count < 4) operands[count] = trim(s);
+        count++;
+        if (!comma) break;
+        s = comma + 1;
+    }
+    if (count == 1 && operands[0][0] == '\0') count = 0;
+    if (count != 4) {
+        asm_error(as, "%s takes 4 operands (rd, rs, rt, imm), got %d", opcodes[op].name, count);
+        return 0;
+    }
+    for (int i = 0; i < 4; i++) {
+        if (operands[i][0] == '\0') {
+            asm_error(as, "operand %d of %s is empty", i + 1, opcodes[op].name);
+            return 0;
+        }
+    }
+
+    uint32_t rd = (uint32_t)parse_register(as, operands[0]);
+    uint32_t rs = (uint32_t)parse_register(as, operands[1]);
+    uint32_t rt = (uint32_t)parse_register(as, operands[2]);
+    uint32_t imm = (uint32_t)parse_immediate(as, operands[3]) & 0xFFF;
+    return ((uint32_t)opcodes[op].opcode << 24) | (rd << 20) | (rs << 16) | (rt << 12) | imm;
+}
+
+long assemble_file(const char* path, uint32_t* words, size_t capacity) {
+    memset(words, 0, capacity * sizeof(uint32_t));
+    char* text = read_source(path);
+    if (!text) {
+        perror(path);
+        return -1;
+    }
+
+    int line_count = 1;
+    for (const char* c = text; *c; c++) line_count += *c == '\n';
+    char** statements = (char**)malloc((size_t)line_count * sizeof(char*));
+    int* statement_lines = (int*)malloc((size_t)line_count * sizeof(int));
+    Assembly as = { path, 0, 0, NULL, 0, 0 };
+    long count = 0;
+    if (!statements || !statement_lines) {
+        asm_error(&as, "out of memory");
+    } else {
+        // Pass 1: labels, and which lines hold an instruction
+        char* line = text;
+        while (line) {
+            char* next = strchr(line, '\n');
+            if (next) *next++ = '\0';
+            as.line++;
+            char* statement = strip_line(&as, line, count);
+            if (statement) {
+                statements[count] = statement;
+                statement_lines[count++] = as.line;
+            }
+            line = next;
+        }
+        if ((size_t)count > capacity) {
+            as.line = statement_lines[capacity];
+            asm_error(&as, "%ld instructions, imem holds %zu", count, capacity);
+        }
+
+        // Pass 2: encode, every label is known now
+        for (long pc = 0; pc < count && (size_t)pc < capacity; pc++) {
+            as.line = statement_lines[pc];
+            words[pc] = encode_statement(&as, statements[pc]);
+        }
+    }
+
+    if (as.errors > 0) {
+        printf("%s: %d error%s\n", path, as.errors, as.errors == 1 ? "" : "s");
+        memset(words, 0, capacity * sizeof(uint32_t));
+        count = -1;
+    }
+    free(as.labels);
+    free(statements);
+    free(statement_lines);
+    free(text);
+    return count;
+}
@@ -0,0 +1,22 @@
+#pragma once
+#include "general_utils.h"
+
+// Assembler for the imem programs, so the imemN.asm sources load without a
+// separate assembly step (see read_imem()). One instruction per line:
+//   [label:]... opcode rd, rs, rt, imm    # comment
+// opcode:    add sub and or xor mul sll sra srl beq bne blt bgt ble bge jal
+//            lw sw halt (any case)
+// registers: $r0..$r15, $zero (= $r0), $imm (= $r1)
+// imm:       decimal or 0x hex, optionally negative, or a label (the PC of
+//            the next instruction after it); -2048..4095, stored in 12 bits
+// Errors are printed as "path:line: message", all of them before giving up.
+
+#define ASM_LABEL_MAX 64
+
+// True if path names an assembly source (ends in ".asm")
+bool is_asm_file(const char* path);
+
+// Assemble path into words: capacity words, those after the program zeroed.
+// Returns the number of instructions, or -1 if the file could not be read or
+// does not assemble.
+long assemble_file(const char* path, uint32_t* words, size_t capacity);
@@ -0,0 +1,198 @@
+#include "batch.h"
+#include "simulator.h"
+#include "sim_thread.h"
+
+#define BATCH_LINE_MAX 4096
+#define BATCH_MAX_ARGS 256
+
+typedef struct {
+    int line_number;
+    char* text;             // Owns the strings argv points into
+    char* argv[BATCH_MAX_ARGS];
+    int argc;
+} BatchJob;
+
+typedef struct {
+    BatchJob* jobs;
+    int job_count;
+    int next_job;
+    int failed;
+    SimMutex lock;          // next_job, failed and stdout
+} Batch;
+
+// Split text on whitespace in place
+static int split_args(char* text, char** argv) {
+    int argc = 0;
+    char* token = strtok(text, " \t\r\n");
+    while (token && argc < BATCH_MAX_ARGS) {
+        argv[argc++] = token;
+        token = strtok(NULL, " \t\r\n");
+    }
+    return argc;
+}
+
+static bool read_manifest(const char* path, Batch* batch) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        perror(path);
+        return false;
+    }
+
+    char line[BATCH_LINE_MAX];
+    int line_number = 0;
+    int capacity = 0;
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), file)) {
+        line_number++;
+        char* comment = strchr(line, '#');
+        if (comment) *comment = '\0';
+
+        if (batch->job_count == capacity) {
+            capacity = capacity ? 2 * capacity : 16;
+            BatchJob* jobs = (BatchJob*)realloc(batch->jobs, (size_t)capacity * sizeof(BatchJob));
+            if (!jobs) {
+                perror("run_batch(): Memory allocation failed");
+                ok = false;
+                break;
+            }
+            batch->jobs = jobs;
+        }
+
+        BatchJob* job = &batch->jobs[batch->job_count];
+        job->line_number = line_number;
+        job->text = (char*)malloc(strlen(line) + 1);
+        if (!job->text) {
+            perror("run_batch(): Memory allocation failed");
+            ok = false;
+            break;
+        }
+        strcpy(job->text, line);
+        job->argc = split_args(job->text, job->argv);
+        if (job->argc == 0) {
+            free(job->text); // Blank line
+            continue;
+        }
+        if (job->argc < 2) {
+            printf("%s:%d: expected \"<output dir> <input dir> [options]\"\n", path, line_number);
+            free(job->text);
+            ok = false;
+            break;
+        }
+        batch->job_count++;
+    }
+    fclose(file);
+    return ok;
+}
+
+// Runs one job on the calling thread, false if it could not run
+static bool run_job(Batch* batch, BatchJob* job, int* cycles, bool* timed_out) {
+    const char* output_dir = job->argv[0];
+    const char* input_dir = job->argv[1];
+
+    SimConfig config;
+    SimFiles files;
+    SimOptions options;
+    if (!parse_arguments(job->argc - 2, job->argv + 2, input_dir, output_dir, &config, &files, &options)) {
+        free_files(&files);
+        return false;
+    }
+    if (!sim_make_dir(output_dir)) {
+        sim_mutex_lock(&batch->lock);
+        perror(output_dir);
+        sim_mutex_unlock(&batch->lock);
+        free_files(&files);
+        return false;
+    }
+
+    Simulator* sim = sim_create(&config, &options);
+    if (!sim) {
+        free_files(&files);
+        return false;
+    }
+    if (!sim_load(sim, &files)) {
+        sim_destroy(sim);
+        return false;
+    }
+    sim_run(sim);
+
+    char* summary_name = (char*)malloc(strlen(output_dir) + sizeof("/summary.txt"));
+    FILE* summary = NULL;
+    if (summary_name) {
+        sprintf(summary_name, "%s/summary.txt", output_dir);
+        summary = fopen(summary_name, "w");
+        free(summary_name);
+    }
+    if (summary) {
+        sim_report(sim, summary);
+        fclose(summary);
+    }
+
+    *cycles = sim->cycle;
+    *timed_out = sim->timed_out;
+    bool ok = summary != NULL;
+    sim_destroy(sim);
+    return ok;
+}
+
+static void batch_worker(void* arg) {
+    Batch* batch = (Batch*)arg;
+    while (true) {
+        sim_mutex_lock(&batch->lock);
+        int index = batch->next_job++;
+        sim_mutex_unlock(&batch->lock);
+        if (index >= batch->job_count) break;
+
+        BatchJob* job = &batch->jobs[index];
+        double start = sim_wall_time();
+        int cycles = 0;
+        bool timed_out = false;
+        bool ok = run_job(batch, job, &cycles, &timed_out);
+
+        sim_mutex_lock(&batch->lock);
+        if (ok && timed_out) {
+            printf("Job %d (line %d, %s): timeout reached\n", index, job->line_number, job->argv[0]);
+            batch->failed++;
+        } else if (ok) {
+            printf("Job %d (line %d, %s): %d cycles in %.3f s\n",
+                index, job->line_number, job->argv[0], cycles, sim_wall_time() - start);
+        } else {
+            printf("Job %d (line %d, %s): failed\n", index, job->line_number, job->argv[0]);
+            batch->failed++;
+        }
+        fflush(stdout);
+        sim_mutex_unlock(&batch->lock);
+    }
+}
+
+int run_batch(const char* manifest, int jobs) {
+    Batch batch;
+    memset(&batch, 0, sizeof(batch));
+    if (!read_manifest(manifest, &batch)) {
+        for (int i = 0; i < batch.job_count; i++) free(batch.jobs[i].text);
+        free(batch.jobs);
+        return 1;
+    }
+
+    if (jobs < 1) jobs = sim_cpu_count();
+    if (jobs > batch.job_count) jobs = batch.job_count;
+    sim_mutex_init(&batch.lock);
+
+    double start = sim_wall_time();
+    SimThread* workers = (SimThread*)calloc((size_t)(jobs > 1 ? jobs : 1), sizeof(SimThread));
+    int started = 0;
+    if (workers) {
+        // The calling thread is worker 0
+        while (started + 1 < jobs && sim_thread_create(&workers[started + 1], batch_worker, &batch)) started++;
+    }
+    batch_worker(&batch);
+    for (int t = 1; t <= started; t++) sim_thread_join(workers[t]);
+    free(workers);
+
+    printf("%d jobs, %d failed, %.3f s on %d threads\n",
+        batch.job_count, batch.failed, sim_wall_time() - start, started + 1);
+
+    sim_mutex_destroy(&batch.lock);
+    for (int i = 0; i < batch.job_count; i++) free(batch.jobs[i].text);
+    free(batch.jobs);
+    return batch.failed;
+}
@@ -0,0 +1,12 @@
+#pragma once
+#include "general_utils.h"
+
+// Batch runner (simulator --batch manifest [--jobs N]): runs the jobs of a
+// manifest on a pool of N threads (default: one per hardware thread), one
+// simulation per thread. One job per line, '#' starts a comment:
+//   <output dir> <input dir> [options and file names as on the command line]
+// The default imem%d.txt / memin.txt inputs are read from the input dir and
+// the default outputs, plus summary.txt (see sim_report()), are written to
+// the output dir, which is created if needed.
+// Returns the number of jobs that failed.
+int run_batch(const char* manifest, int jobs);
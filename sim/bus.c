@@ -1,183 +1,640 @@
 #include "bus.h"
+#include "memory.h"
+#include "sim_thread.h"
+#include "miss_class.h"
 
-void init_bus(Core * core[CORE_COUNT]){
-    for(int i = 0; i < CORE_COUNT; i++){
-        system_bus.cpu_cache[i] = &(core[i]->cache);
-        system_bus.bus_interface[i] = &(core[i]->bus_interface);
+#define BLOCK_NUMBER(ctx, tag, set) (BLOCK_ADDRESS(ctx, tag, set) >> (ctx)->config.offset_bits)
+
+bool init_bus(SimContext* ctx, Core ** core){
+    ctx->bus.cpu_cache = (Cache**)calloc((size_t)ctx->config.core_count, sizeof(Cache*));
+    ctx->bus.bus_interface = (BusInterface**)calloc((size_t)ctx->config.core_count, sizeof(BusInterface*));
+    if (!ctx->bus.cpu_cache || !ctx->bus.bus_interface) return false;
+
+    // Snoop filter: one sharer bitmap per block of main memory (all caches start invalid)
+    ctx->bus.sharers = NULL;
+    ctx->bus.pending_requests = 0;
+    if (ctx->config.snoop_filter) {
+        ctx->bus.sharers = (uint64_t*)calloc((size_t)(MEMIN_DEPTH >> ctx->config.offset_bits), sizeof(uint64_t));
+        if (!ctx->bus.sharers) return false;
+    }
+
+    ctx->bus.inflight = NULL;
+    ctx->bus.inflight_count = 0;
+    ctx->bus.data_transfer = -1;
+    if (ctx->config.split_bus) {
+        ctx->bus.inflight = (BusTransaction*)calloc((size_t)ctx->config.bus_inflight, sizeof(BusTransaction));
+        if (!ctx->bus.inflight) return false;
+    }
+
+    ctx->bus.word_written = NULL;
+    ctx->bus.block_classes = NULL;
+    if (ctx->config.classify_misses && !init_bus_miss_tables(ctx)) return false;
+
+    ctx->bus.prefetch_interface = NULL;
+    if (ctx->config.prefetch != PREFETCH_NONE) {
+        ctx->bus.prefetch_interface = (BusInterface**)calloc((size_t)ctx->config.core_count, sizeof(BusInterface*));
+        if (!ctx->bus.prefetch_interface) return false;
+    }
+
+    for(int i = 0; i < ctx->config.core_count; i++){
+        ctx->bus.cpu_cache[i] = &(core[i]->cache);
+        ctx->bus.bus_interface[i] = &(core[i]->bus_interface);
+        if (ctx->bus.prefetch_interface) ctx->bus.prefetch_interface[i] = &(core[i]->prefetch_interface);
+    }
+    return true;
+}
+
+void free_bus(SimContext* ctx){
+    free(ctx->bus.cpu_cache);
+    free(ctx->bus.bus_interface);
+    free(ctx->bus.prefetch_interface);
+    free(ctx->bus.sharers);
+    free(ctx->bus.inflight);
+    free_bus_miss_tables(ctx);
+    ctx->bus.cpu_cache = NULL;
+    ctx->bus.bus_interface = NULL;
+    ctx->bus.prefetch_interface = NULL;
+    ctx->bus.sharers = NULL;
+    ctx->bus.inflight = NULL;
+}
+
+// Every MESI transition done by the bus goes through here, so the sharer
+// bitmaps always match "mesi_state != INVALID && tag matches" of the TSRAMs.
+static void set_line_state(SimContext* ctx, int core, int cache_line, uint32_t tag, MESI_State state){
+    Cache *cache = ctx->bus.cpu_cache[core];
+    TSRAM_Line *line = &cache->tsram[cache_line];
+    if (cache->prefetched && cache->prefetched[cache_line] && (state == MESI_INVALID || tag != line->tag)) {
+        cache->prefetched[cache_line] = 0;
+        cache->prefetch_useless++;
+    }
+    if (ctx->bus.sharers) {
+        uint64_t bit = 1ULL << core;
+        uint32_t set = LINE_SET(ctx, cache_line);
+        if (line->mesi_state != MESI_INVALID) ctx->bus.sharers[BLOCK_NUMBER(ctx, line->tag, set)] &= ~bit;
+        if (state != MESI_INVALID) ctx->bus.sharers[BLOCK_NUMBER(ctx, tag, set)] |= bit;
+    }
+    if (cache->block_history) {
+        // Invalidations by another core overwrite the history (see address_phase())
+        uint32_t set = LINE_SET(ctx, cache_line);
+        if (line->mesi_state != MESI_INVALID && (state == MESI_INVALID || tag != line->tag)) {
+            note_block_left(cache, BLOCK_NUMBER(ctx, line->tag, set));
+        }
+        if (state != MESI_INVALID) note_block_cached(ctx, cache, BLOCK_NUMBER(ctx, tag, set));
+    }
+    line->tag = tag;
+    line->mesi_state = state;
+}
+
+typedef enum { BUS_CYCLE_IDLE = 0, BUS_CYCLE_ADDRESS, BUS_CYCLE_COOLDOWN, BUS_CYCLE_TRANSFER } BusActivity;
+
+// Statistics of count cycles in which the bus did activity. Demand requests
+// still waiting after arbitration count a wait cycle.
+static void count_cycles(SimContext* ctx, BusActivity activity, int count){
+    BusCycleStats *stats = &ctx->bus.cycle_stats;
+    switch (activity) {
+        case BUS_CYCLE_IDLE: stats->idle_cycles += count; break;
+        case BUS_CYCLE_ADDRESS: stats->address_cycles += count; break;
+        case BUS_CYCLE_COOLDOWN: stats->cooldown_cycles += count; break;
+        case BUS_CYCLE_TRANSFER: stats->transfer_cycles += count; break;
+    }
+    for (int c = 0; c < ctx->config.core_count; c++) {
+        const BusInterface *bi = ctx->bus.bus_interface[c];
+        if (bi->has_pending_request && !bi->request_issued && !bi->request_done) {
+            ctx->bus.core_stats[c].wait_cycles += count;
+        }
+    }
+}
+
+// Split bus: is a transaction for the block of address already in flight?
+// Requests for such a block wait until it completes, so conflicting
+// requests are serialized exactly as on the atomic bus.
+static bool block_in_flight(SimContext* ctx, uint32_t address){
+    uint32_t block = address >> ctx->config.offset_bits;
+    for (int i = 0; i < ctx->bus.inflight_count; i++) {
+        if ((ctx->bus.inflight[i].addr >> ctx->config.offset_bits) == block) return true;
+    }
+    return false;
+}
+
+static bool request_can_issue(SimContext* ctx, int id){
+    BusInterface *bi = ctx->bus.bus_interface[id];
+    if (!bi->has_pending_request || bi->request_done || bi->request_issued) return false;
+    // One fill per cache at a time: a prefetch in flight holds back the core's demand
+    if (ctx->bus.prefetch_interface && ctx->bus.prefetch_interface[id]->request_issued) return false;
+    return !ctx->config.split_bus || !block_in_flight(ctx, bi->request.bus_addr);
+}
+
+// Next core with a prefetch to issue, asked only while no demand request can go.
+// Prefetches whose block arrived meanwhile, or that a demand miss of their
+// core asks for itself, are dropped here.
+static int next_prefetcher(SimContext* ctx){
+    if (!ctx->bus.prefetch_interface) return -1;
+    int start = (ctx->bus.last_granted_device + 1) % ctx->config.core_count;
+    for (int i = 0; i < ctx->config.core_count; i++) {
+        int id = (start + i) % ctx->config.core_count;
+        BusInterface *pi = ctx->bus.prefetch_interface[id];
+        if (!pi->has_pending_request || pi->request_issued) continue;
+
+        BusInterface *bi = ctx->bus.bus_interface[id];
+        uint32_t block = pi->request.bus_addr >> ctx->config.offset_bits;
+        bool demanded = bi->has_pending_request && (bi->request.bus_addr >> ctx->config.offset_bits) == block;
+        if (demanded || find_cache_line(ctx, ctx->bus.cpu_cache[id], pi->request.bus_addr) >= 0) {
+            pi->has_pending_request = false;
+            continue;
+        }
+        return id;
+    }
+    return -1;
+}
+
+// Next core with a request to issue, round-robin after last_granted_device (-1 if none)
+static int next_requester(SimContext* ctx){
+    int start = (ctx->bus.last_granted_device + 1) % ctx->config.core_count;
+
+    if (ctx->bus.sharers) {
+        // Pending-request bitmap: set bits at or after start first, then wrap around
+        uint64_t pending = ctx->bus.pending_requests;
+        uint64_t order[2] = { pending & (~0ULL << start), pending & ~(~0ULL << start) };
+        for (int half = 0; half < 2; half++) {
+            while (order[half]) {
+                int id = sim_lowest_bit64(order[half]);
+                order[half] &= order[half] - 1;
+                if (request_can_issue(ctx, id)) return id;
+            }
+        }
+        return -1;
+    }
+
+    for (int i = 0; i < ctx->config.core_count; i++) {
+        int id = (start + i) % ctx->config.core_count;
+        if (request_can_issue(ctx, id)) return id;
     }
+    return -1;
 }
 
-void send_bus_read_request(Core * core, uint32_t address, bool exclusive){
+// Caches to probe for a request of core id: the sharers of the block, or every other core
+static uint64_t snoop_candidates(SimContext* ctx, int id, uint32_t tag, uint32_t set){
+    uint64_t all = ctx->config.core_count == 64 ? ~0ULL : (1ULL << ctx->config.core_count) - 1;
+    uint64_t candidates = all;
+    if (ctx->bus.sharers) candidates = ctx->bus.sharers[BLOCK_NUMBER(ctx, tag, set)];
+    candidates &= ~(1ULL << id); // Don't snoop self
+
+    int probes = sim_popcount64(candidates);
+    ctx->bus.snoop_probes += probes;
+    ctx->bus.snoop_probes_avoided += ctx->config.core_count - 1 - probes;
+    return candidates;
+}
+
+static void post_request(SimContext * ctx, Core * core, uint32_t address, BusCmd cmd){
     if (core->bus_interface.has_pending_request) return;
 
     core->bus_interface.request.bus_orig_id = core->id;
     core->bus_interface.request.bus_addr = address;
-    core->bus_interface.request.bus_cmd = exclusive ? BUS_RDX : BUS_RD;
+    core->bus_interface.request.bus_cmd = cmd;
     core->bus_interface.has_pending_request = true;
     core->bus_interface.request_done = false;
+    if (ctx->bus.sharers) sim_atomic_or64(&ctx->bus.pending_requests, 1ULL << core->id);
 }
 
-void bus_handler(){
-    // Reset bus wire if idle
-    if (!system_bus.busy) {
-        system_bus.bus_cmd = BUS_NOCMD;
-        system_bus.bus_orig_id = 0;
-        system_bus.bus_addr = 0;
-        system_bus.bus_data = 0;
-        system_bus.bus_shared = false;
-        system_bus.flush_post_state_valid = false;
+// Low priority BusRd on the core's prefetch interface, ignored while the
+// previous one is still waiting
+void send_prefetch_request(Core * core, uint32_t address){
+    BusInterface *pi = &core->prefetch_interface;
+    if (pi->has_pending_request) return;
+    pi->request.bus_orig_id = core->id;
+    pi->request.bus_addr = address;
+    pi->request.bus_cmd = BUS_RD;
+    pi->request_done = false;
+    pi->has_pending_request = true;
+}
+
+void send_bus_read_request(SimContext * ctx, Core * core, uint32_t address, bool exclusive){
+    post_request(ctx, core, address, exclusive ? BUS_RDX : BUS_RD);
+}
+
+// The line is SHARED in the core's cache. If it is lost before the bus gets
+// to the request, the bus turns it into a full BUS_RDX.
+void send_bus_upgrade_request(SimContext * ctx, Core * core, uint32_t address){
+    post_request(ctx, core, address, BUS_UPGR);
+}
+
+// Put transaction t on the bus wire (the data is set per transferred word)
+static void drive_wire(SimContext* ctx, const BusTransaction* t){
+    ctx->bus.bus_orig_id = t->orig_id;
+    ctx->bus.bus_cmd = t->cmd;
+    ctx->bus.bus_addr = t->addr;
+    ctx->bus.bus_shared = t->shared;
+}
+
+static void clear_wire(SimContext* ctx){
+    ctx->bus.bus_cmd = BUS_NOCMD;
+    ctx->bus.bus_orig_id = 0;
+    ctx->bus.bus_addr = 0;
+    ctx->bus.bus_data = 0;
+    ctx->bus.bus_shared = false;
+}
+
+// Move word word_offset of t over the bus, returns true after the last word
+static bool transfer_word(SimContext* ctx, const BusTransaction* t){
+    Cache *cache = ctx->bus.cpu_cache[t->orig_id];
+
+    // Align address to the start of the block (Critical Fix)
+    // System is Word Addressed. Mask the block offset bits.
+    uint32_t mem_block_addr = t->addr & ~(uint32_t)(ctx->config.block_size - 1); 
+    
+    if ((t->cmd == BUS_RD || t->cmd == BUS_RDX) && t->source >= 0) {
+        // Cache -> Bus -> Cache (MOESI / MESIF), memory is not involved.
+        // The block was latched into the line in the address phase.
+        ctx->bus.bus_data = CACHE_WORD(ctx, cache, t->line, ctx->bus.word_offset);
+
+    } else if (t->cmd == BUS_RD || t->cmd == BUS_RDX) {
+        // Read from Main Memory -> Bus -> Cache
+        uint32_t data = ctx->bus.system_memory[mem_block_addr + ctx->bus.word_offset];
+        ctx->bus.bus_data = data;
+        CACHE_WORD(ctx, cache, t->line, ctx->bus.word_offset) = data;
+    
+    } else if (t->cmd == BUS_FLUSH) {
+        // Write from Cache -> Bus -> Main Memory
+        uint32_t data = CACHE_WORD(ctx, cache, t->line, ctx->bus.word_offset);
+        ctx->bus.bus_data = data;
+        ctx->bus.system_memory[mem_block_addr + ctx->bus.word_offset] = data;
     }
 
-    // 1. ACTIVE TRANSACTION
-    if (system_bus.busy) {
-        // Cooldown for latency
-        if (system_bus.cooldown_timer > 0) {
-            system_bus.cooldown_timer--;
-            return;
+    ctx->bus.word_offset++;
+    return ctx->bus.word_offset >= ctx->config.block_size;
+}
+
+// Last word of t transferred
+static void finish_transaction(SimContext* ctx, const BusTransaction* t){
+    // Update MESI States
+    // (a FLUSH already left M when it started, see address_phase())
+    if (t->cmd == BUS_RD) {
+        // MESIF: the newest sharer is the one that forwards
+        MESI_State shared_state = ctx->config.protocol == PROTOCOL_MESIF ? MESI_FORWARD : MESI_SHARED;
+        MESI_State new_state = t->shared ? shared_state : MESI_EXCLUSIVE;
+        set_line_state(ctx, t->orig_id, t->line, CACHE_TAG(ctx, t->addr), new_state);
+        touch_cache_line(ctx, ctx->bus.cpu_cache[t->orig_id], t->line);
+    } 
+    else if (t->cmd == BUS_RDX || t->cmd == BUS_UPGR) {
+        set_line_state(ctx, t->orig_id, t->line, CACHE_TAG(ctx, t->addr), MESI_MODIFIED);
+        touch_cache_line(ctx, ctx->bus.cpu_cache[t->orig_id], t->line);
+    } 
+
+    if (t->prefetch) {
+        Cache *cache = ctx->bus.cpu_cache[t->orig_id];
+        cache->prefetched[t->line] = 1;
+        BusInterface *pi = ctx->bus.prefetch_interface[t->orig_id];
+        pi->has_pending_request = false;
+        pi->request_issued = false;
+
+        // A demand miss to the block that waited for us is served as well
+        BusInterface *bi = ctx->bus.bus_interface[t->orig_id];
+        if (bi->has_pending_request && !bi->request_issued && bi->request.bus_cmd == BUS_RD &&
+            (bi->request.bus_addr >> ctx->config.offset_bits) == (t->addr >> ctx->config.offset_bits)) {
+            bi->request_done = true;
+            bi->has_pending_request = false;
+            if (ctx->bus.sharers) sim_atomic_and64(&ctx->bus.pending_requests, ~(1ULL << t->orig_id));
+            cache->prefetch_late++;
         }
+        return;
+    }
 
-        // Processing Transfer
-        int requester = system_bus.bus_orig_id;
-        int cache_idx = (system_bus.bus_addr >> 3) & 0x3F;
-        
-        // Align address to the start of the block (Critical Fix)
-        // System is Word Addressed. Block is 8 words. Mask last 3 bits.
-        uint32_t mem_block_addr = system_bus.bus_addr & ~(CACHE_BLOCK_SIZE - 1); 
-        
-        if (system_bus.bus_cmd == BUS_RD || system_bus.bus_cmd == BUS_RDX) {
-            // Read from Main Memory -> Bus -> Cache
-            uint32_t data = system_bus.system_memory[mem_block_addr + system_bus.word_offset];
-            system_bus.bus_data = data;
-            system_bus.cpu_cache[requester]->dsram[cache_idx].word[system_bus.word_offset] = data;
+    // Important: Only clear the pending flag if this was a requested op, not a forced snoop flush
+    if (t->cmd != BUS_FLUSH) {
+        BusInterface *bi = ctx->bus.bus_interface[t->orig_id];
+        bi->request_done = true;
+        bi->has_pending_request = false;
+        bi->request_issued = false;
+    }
+}
+
+// Address phase of core id's request (or prefetch): snoop the other caches and
+// fill in the transaction to run. That is either the request itself (returns
+// true), or a FLUSH that has to come first, in which case the request stays pending.
+static bool address_phase(SimContext* ctx, int id, bool prefetch, BusTransaction* t){
+    BusInterface *bi = prefetch ? ctx->bus.prefetch_interface[id] : ctx->bus.bus_interface[id];
+    bool exclusive = bi->request.bus_cmd != BUS_RD;
+
+    // Each new BusRd/BusRdX transaction starts with bus_shared = 0
+    t->shared = false;
+    t->prefetch = false;
+    t->source = -1;
+
+    // Replacement: the fill goes to the way already holding the block, else an
+    // invalid way, else the victim picked by the replacement policy (see memory.c).
+    // If the requester is about to replace a MODIFIED line (different tag),
+    // we must FLUSH it to main memory BEFORE granting the new request.
+    uint32_t req_idx = CACHE_INDEX(ctx, bi->request.bus_addr);
+    uint32_t req_tag = CACHE_TAG(ctx, bi->request.bus_addr);
+    int fill_line = choose_fill_line(ctx, ctx->bus.cpu_cache[id], bi->request.bus_addr);
+    TSRAM_Line *rline = &ctx->bus.cpu_cache[id]->tsram[fill_line];
+
+    bool victim_dirty = rline->mesi_state == MESI_MODIFIED || rline->mesi_state == MESI_OWNED;
+    if (victim_dirty && rline->tag != req_tag) {
+        // Flush the old block (tag/set -> word address)
+        // This is an eviction flush: the line is being replaced, so it becomes INVALID.
+        // (An OWNED line holds the only up-to-date copy as well.)
+        t->orig_id = id;
+        t->cmd = BUS_FLUSH;
+        t->addr = BLOCK_ADDRESS(ctx, rline->tag, req_idx);
+        t->line = fill_line;
+        set_line_state(ctx, id, fill_line, rline->tag, MESI_INVALID);
+        ctx->bus.flushes++;
+        ctx->bus.core_stats[id].eviction_flushes++;
+        ctx->bus.core_stats[id].grants[BUS_FLUSH]++;
+        return false;
+    }
+
+    // MOESI: memory may be stale while we hold the block OWNED, our copy is the data
+    if (rline->mesi_state == MESI_OWNED && rline->tag == req_tag) {
+        t->source = id;
+    }
+    
+    // SNOOPING: other cores respond / invalidate
+    int source_line = -1;
+    uint32_t tag = req_tag;
+    uint32_t idx = req_idx;
+
+    uint64_t candidates = snoop_candidates(ctx, id, tag, idx);
+    while (candidates) {
+        int c = sim_lowest_bit64(candidates);
+        candidates &= candidates - 1;
         
-        } else if (system_bus.bus_cmd == BUS_FLUSH) {
-            // Write from Cache -> Bus -> Main Memory
-            uint32_t data = system_bus.cpu_cache[requester]->dsram[cache_idx].word[system_bus.word_offset];
-            system_bus.bus_data = data;
-            system_bus.system_memory[mem_block_addr + system_bus.word_offset] = data;
-        }
+        int snoop_line = find_cache_line(ctx, ctx->bus.cpu_cache[c], bi->request.bus_addr);
+        if (snoop_line >= 0) {
+            TSRAM_Line *line = &ctx->bus.cpu_cache[c]->tsram[snoop_line];
+            MESI_State state = line->mesi_state;
+            t->shared = true; // Signal shared
 
-        system_bus.word_offset++;
+            // Cache-to-cache transfer: MOESI lets a dirty owner supply the data
+            // (memory stays stale), MESIF the clean forwarder or exclusive copy.
+            bool dirty_supplier = ctx->config.protocol == PROTOCOL_MOESI &&
+                (state == MESI_MODIFIED || state == MESI_OWNED);
+            bool clean_supplier = ctx->config.protocol == PROTOCOL_MESIF &&
+                (state == MESI_FORWARD || state == MESI_EXCLUSIVE);
+            if (dirty_supplier || clean_supplier) {
+                t->source = c;
+                source_line = snoop_line;
+            }
 
-        // Transaction Complete
-        if (system_bus.word_offset >= CACHE_BLOCK_SIZE) {
-            
-            // Update MESI States
-            if (system_bus.bus_cmd == BUS_RD) {
-                MESI_State new_state = system_bus.bus_shared ? MESI_SHARED : MESI_EXCLUSIVE;
-                system_bus.cpu_cache[requester]->tsram[cache_idx].mesi_state = new_state;
-                system_bus.cpu_cache[requester]->tsram[cache_idx].tag = (system_bus.bus_addr >> 9) & 0xFFF;
-            } 
-            else if (system_bus.bus_cmd == BUS_RDX) {
-                system_bus.cpu_cache[requester]->tsram[cache_idx].mesi_state = MESI_MODIFIED;
-                system_bus.cpu_cache[requester]->tsram[cache_idx].tag = (system_bus.bus_addr >> 9) & 0xFFF;
-            } 
-            else if (system_bus.bus_cmd == BUS_FLUSH) {
-                // Apply the correct post-FLUSH MESI state.
-                // Eviction flush: INVALID
-                // Snoop flush on BUS_RD: SHARED (M->S)
-                // Snoop flush on BUS_RDX: INVALID (M->I)
-                MESI_State post = MESI_INVALID;
-                if (system_bus.flush_post_state_valid) {
-                    post = system_bus.flush_post_state;
-                }
-                system_bus.cpu_cache[requester]->tsram[cache_idx].mesi_state = post;
-                system_bus.flush_post_state_valid = false;
+            // MESI fix: if another core issues BUS_RD while we hold the line in EXCLUSIVE,
+            // we must downgrade to SHARED. The same goes for the MESIF forwarder, the
+            // requester forwards from now on; a MOESI owner keeps the dirty data.
+            if (!exclusive && (state == MESI_EXCLUSIVE || state == MESI_FORWARD)) {
+                set_line_state(ctx, c, snoop_line, line->tag, MESI_SHARED);
+                if (state == MESI_EXCLUSIVE) ctx->bus.core_stats[c].exclusive_to_shared++;
+            }
+            if (!exclusive && dirty_supplier) {
+                set_line_state(ctx, c, snoop_line, line->tag, MESI_OWNED);
             }
 
-            // Important: Only clear the pending flag if this was a requested op, not a forced snoop flush
-            if (system_bus.bus_cmd != BUS_FLUSH) {
-                 system_bus.bus_interface[requester]->request_done = true;
-                 system_bus.bus_interface[requester]->has_pending_request = false;
+            if (line->mesi_state == MESI_MODIFIED && !dirty_supplier) {
+                // Found a MODIFIED line in another cache. Must FLUSH it so main memory is up-to-date.
+                // Post-FLUSH state depends on requester cmd:
+                // - BUS_RD  : M -> S
+                // - BUS_RDX : M -> I
+                // Leave M right away: a store hitting the line while it is
+                // being flushed would otherwise be lost once the flush ends.
+                MESI_State post = exclusive ? MESI_INVALID : MESI_SHARED;
+                set_line_state(ctx, c, snoop_line, line->tag, post);
+                t->orig_id = c; // The flusher
+                t->cmd = BUS_FLUSH;
+                t->addr = bi->request.bus_addr;
+                t->line = snoop_line;
+                ctx->bus.flushes++;
+                ctx->bus.core_stats[c].snoop_flushes++;
+                ctx->bus.core_stats[c].grants[BUS_FLUSH]++;
+                if (exclusive) {
+                    ctx->bus.core_stats[id].invalidations_sent++;
+                    ctx->bus.core_stats[c].invalidations_received++;
+                    if (ctx->config.classify_misses) note_block_invalidated(ctx, ctx->bus.cpu_cache[c], BLOCK_NUMBER(ctx, tag, idx));
+                }
+                return false; // Start flush immediately
             }
             
-            system_bus.busy = false;
-            system_bus.last_granted_device = requester;
-            system_bus.word_offset = 0;
+            if (exclusive) {
+                set_line_state(ctx, c, snoop_line, line->tag, MESI_INVALID); // Invalidate others on Write
+                ctx->bus.core_stats[id].invalidations_sent++;
+                ctx->bus.core_stats[c].invalidations_received++;
+                if (ctx->config.classify_misses) note_block_invalidated(ctx, ctx->bus.cpu_cache[c], BLOCK_NUMBER(ctx, tag, idx));
+            }
         }
-        return;
     }
 
-    // 2. ARBITRATION
-    int start = (system_bus.last_granted_device + 1) % CORE_COUNT;
-    for (int i = 0; i < CORE_COUNT; i++) {
-        int id = (start + i) % CORE_COUNT;
-        BusInterface *bi = system_bus.bus_interface[id];
-
-        if (bi->has_pending_request && !bi->request_done) {
-
-            // Each new BusRd/BusRdX transaction starts with bus_shared = 0
-            system_bus.bus_shared = false;
-
-            // Replacement policy: direct-mapped.
-            // If the requester is about to replace a MODIFIED line (different tag),
-            // we must FLUSH it to main memory BEFORE granting the new request.
-            uint32_t req_idx = (bi->request.bus_addr >> 3) & 0x3F;
-            uint32_t req_tag = (bi->request.bus_addr >> 9) & 0xFFF;
-            TSRAM_Line *rline = &system_bus.cpu_cache[id]->tsram[req_idx];
-
-            if (rline->mesi_state == MESI_MODIFIED && rline->tag != req_tag) {
-                // Flush the old block (tag/index -> word address)
-                // This is an eviction flush: the line is being replaced, so it becomes INVALID.
-                uint32_t old_block_addr = ((rline->tag & 0xFFF) << 9) | (req_idx << 3);
-                system_bus.flush_post_state = MESI_INVALID;
-                system_bus.flush_post_state_valid = true;
-                system_bus.busy = true;
-                system_bus.bus_orig_id = id;
-                system_bus.bus_cmd = BUS_FLUSH;
-                system_bus.bus_addr = old_block_addr;
-                system_bus.cooldown_timer = 0;
-                system_bus.word_offset = 0;
-                return;
-            }
-            
-            // SNOOPING: other cores respond / invalidate
-            uint32_t tag = req_tag;
-            uint32_t idx = req_idx;
-
-            for(int c = 0; c < CORE_COUNT; c++) {
-                if (c == id) continue; // Don't snoop self
-                
-                TSRAM_Line *line = &system_bus.cpu_cache[c]->tsram[idx];
-                if (line->mesi_state != MESI_INVALID && line->tag == tag) {
-                    system_bus.bus_shared = true; // Signal shared
-
-                    // MESI fix: if another core issues BUS_RD while we hold the line in EXCLUSIVE,
-                    // we must downgrade to SHARED.
-                    if (bi->request.bus_cmd == BUS_RD && line->mesi_state == MESI_EXCLUSIVE) {
-                        line->mesi_state = MESI_SHARED;
-                    }
-
-                    if (line->mesi_state == MESI_MODIFIED) {
-                        // Found a MODIFIED line in another cache. Must FLUSH it so main memory is up-to-date.
-                        // Post-FLUSH state depends on requester cmd:
-                        // - BUS_RD  : M -> S
-                        // - BUS_RDX : M -> I
-                        system_bus.flush_post_state = (bi->request.bus_cmd == BUS_RD) ? MESI_SHARED : MESI_INVALID;
-                        system_bus.flush_post_state_valid = true;
-                        system_bus.busy = true;
-                        system_bus.bus_orig_id = c; // The flusher
-                        system_bus.bus_cmd = BUS_FLUSH;
-                        system_bus.bus_addr = bi->request.bus_addr;
-                        system_bus.cooldown_timer = 0; 
-                        system_bus.word_offset = 0;
-                        return; // Start flush immediately
-                    }
-                    
-                    if (bi->request.bus_cmd == BUS_RDX) {
-                        line->mesi_state = MESI_INVALID; // Invalidate others on Write
-                    }
-                }
+    // A clean victim is dropped now, the fill owns its line from here on
+    if (rline->mesi_state != MESI_INVALID && rline->tag != req_tag) {
+        set_line_state(ctx, id, fill_line, rline->tag, MESI_INVALID);
+    }
+
+    // Grant Bus
+    // An upgrade whose SHARED copy was invalidated meanwhile needs the data again
+    t->orig_id = id;
+    t->cmd = bi->request.bus_cmd;
+    bool has_copy = rline->tag == req_tag &&
+        (rline->mesi_state == MESI_SHARED || rline->mesi_state == MESI_OWNED || rline->mesi_state == MESI_FORWARD);
+    if (t->cmd == BUS_UPGR && !has_copy) t->cmd = BUS_RDX;
+    if (t->cmd == BUS_UPGR) ctx->bus.upgrades++;
+    if (t->cmd == BUS_RDX) ctx->bus.rdx_requests++;
+    if (t->cmd != BUS_UPGR) {
+        if (t->source >= 0) ctx->bus.cache_transfers++;
+        else ctx->bus.memory_reads++;
+    }
+    t->addr = bi->request.bus_addr;
+    t->line = fill_line;
+
+    // Latch the supplier's block now: its line may be refilled (split bus)
+    // before our data phase. Our line stays INVALID until the last word.
+    if (t->cmd != BUS_UPGR && source_line >= 0) {
+        memcpy(&CACHE_WORD(ctx, ctx->bus.cpu_cache[id], fill_line, 0),
+            &CACHE_WORD(ctx, ctx->bus.cpu_cache[t->source], source_line, 0),
+            ctx->config.block_size * sizeof(uint32_t));
+    }
+    bi->request_issued = true;
+    t->prefetch = prefetch;
+    if (prefetch) {
+        ctx->bus.cpu_cache[id]->prefetch_issued++;
+        ctx->bus.core_stats[id].prefetches++;
+    } else {
+        ctx->bus.core_stats[id].grants[t->cmd]++;
+        if (ctx->bus.sharers) sim_atomic_and64(&ctx->bus.pending_requests, ~(1ULL << id));
+    }
+    return true;
+}
+
+// Split-transaction bus: the address phase takes one cycle and the memory
+// latency of up to bus_inflight transactions runs down in parallel, the bus
+// only carries one data burst at a time (oldest ready transaction first).
+static BusActivity split_bus_handler(SimContext* ctx){
+    clear_wire(ctx);
+
+    for (int i = 0; i < ctx->bus.inflight_count; i++) {
+        if (ctx->bus.inflight[i].ready_timer > 0) ctx->bus.inflight[i].ready_timer--;
+    }
+
+    // 1. DATA PHASE
+    if (ctx->bus.data_transfer < 0) {
+        for (int i = 0; i < ctx->bus.inflight_count; i++) {
+            const BusTransaction *t = &ctx->bus.inflight[i];
+            if (t->ready_timer > 0) continue;
+            if (ctx->bus.data_transfer < 0 || t->sequence < ctx->bus.inflight[ctx->bus.data_transfer].sequence) {
+                ctx->bus.data_transfer = i;
             }
+        }
+        ctx->bus.word_offset = 0;
+    }
 
-            // Grant Bus
-            system_bus.busy = true;
-            system_bus.bus_orig_id = id;
-            system_bus.bus_cmd = bi->request.bus_cmd;
-            system_bus.bus_addr = bi->request.bus_addr;
-            system_bus.cooldown_timer = BUS_DELAY;
-            system_bus.word_offset = 0;
-            return;
+    if (ctx->bus.data_transfer >= 0) {
+        BusTransaction *t = &ctx->bus.inflight[ctx->bus.data_transfer];
+        drive_wire(ctx, t);
+        if (transfer_word(ctx, t)) {
+            finish_transaction(ctx, t);
+            *t = ctx->bus.inflight[--ctx->bus.inflight_count];
+            ctx->bus.data_transfer = -1;
         }
+        return BUS_CYCLE_TRANSFER;
+    }
+
+    // 2. ADDRESS PHASE
+    // Prefetches only go on an idle bus
+    BusActivity waiting = ctx->bus.inflight_count > 0 ? BUS_CYCLE_COOLDOWN : BUS_CYCLE_IDLE;
+    if (ctx->bus.inflight_count >= ctx->config.bus_inflight) return waiting;
+    int id = next_requester(ctx);
+    bool prefetch = id < 0 && ctx->bus.inflight_count == 0;
+    if (prefetch) id = next_prefetcher(ctx);
+    if (id < 0) return waiting;
+
+    BusTransaction t;
+    bool is_request = address_phase(ctx, id, prefetch, &t);
+    drive_wire(ctx, &t);
+
+    // An upgrade is done with its address phase
+    if (t.cmd == BUS_UPGR) {
+        finish_transaction(ctx, &t);
+        ctx->bus.last_granted_device = id;
+        return BUS_CYCLE_ADDRESS;
     }
-}
\ No newline at end of file
+
+    // +1: the data can follow from the cycle after this address phase on
+    // Only main memory has a latency, flushes and cache-to-cache data start right away
+    bool from_memory = is_request && t.source < 0;
+    t.ready_timer = (from_memory ? ctx->config.bus_delay : 0) + 1;
+    t.sequence = ctx->bus.next_sequence++;
+    ctx->bus.inflight[ctx->bus.inflight_count++] = t;
+    if (is_request && !prefetch) ctx->bus.last_granted_device = id;
+    return BUS_CYCLE_ADDRESS;
+}
+
+// Atomic bus: one transaction holds the bus from its grant to its last word
+static BusActivity atomic_bus_handler(SimContext* ctx){
+    // Reset bus wire if idle
+    if (!ctx->bus.busy) clear_wire(ctx);
+
+    // 1. ACTIVE TRANSACTION
+    if (ctx->bus.busy) {
+        // Cooldown for latency
+        if (ctx->bus.cooldown_timer > 0) {
+            ctx->bus.cooldown_timer--;
+            return BUS_CYCLE_COOLDOWN;
+        }
+
+        // Processing Transfer
+        // Transaction Complete
+        if (transfer_word(ctx, &ctx->bus.active)) {
+            finish_transaction(ctx, &ctx->bus.active);
+            ctx->bus.busy = false;
+            if (!ctx->bus.active.prefetch) ctx->bus.last_granted_device = ctx->bus.active.orig_id;
+            ctx->bus.word_offset = 0;
+        }
+        return BUS_CYCLE_TRANSFER;
+    }
+
+    // 2. ARBITRATION
+    // Prefetches only get the bus when no demand request wants it
+    int id = next_requester(ctx);
+    bool prefetch = id < 0;
+    if (prefetch) id = next_prefetcher(ctx);
+    if (id < 0) return BUS_CYCLE_IDLE;
+
+    // Flushes and cache-to-cache data use the bus right away, memory reads wait out the latency
+    bool is_request = address_phase(ctx, id, prefetch, &ctx->bus.active);
+    drive_wire(ctx, &ctx->bus.active);
+
+    // An upgrade moves no data: the bus is free again next cycle
+    if (ctx->bus.active.cmd == BUS_UPGR) {
+        finish_transaction(ctx, &ctx->bus.active);
+        ctx->bus.last_granted_device = id;
+        return BUS_CYCLE_ADDRESS;
+    }
+    ctx->bus.busy = true;
+    ctx->bus.cooldown_timer = (is_request && ctx->bus.active.source < 0) ? ctx->config.bus_delay : 0;
+    ctx->bus.word_offset = 0;
+    return BUS_CYCLE_ADDRESS;
+}
+
+void bus_handler(SimContext* ctx){
+    count_cycles(ctx, ctx->config.split_bus ? split_bus_handler(ctx) : atomic_bus_handler(ctx), 1);
+}
+
+void bus_skip_cooldown(SimContext* ctx, int count){
+    ctx->bus.cooldown_timer -= count;
+    count_cycles(ctx, BUS_CYCLE_COOLDOWN, count);
+}
+
+// The protocol's transitions of a BusRd / BusRdX, with the data moved right
+// away: a dirty victim and a MESI MODIFIED copy go back to memory, a MOESI
+// owner or the MESIF forwarder supplies the block (see address_phase())
+int bus_functional_access(SimContext* ctx, int id, uint32_t address, bool exclusive){
+    Cache *cache = ctx->bus.cpu_cache[id];
+    size_t block_bytes = (size_t)ctx->config.block_size * sizeof(uint32_t);
+    uint32_t tag = CACHE_TAG(ctx, address);
+    uint32_t idx = CACHE_INDEX(ctx, address);
+    int fill_line = choose_fill_line(ctx, cache, address);
+    TSRAM_Line *rline = &cache->tsram[fill_line];
+
+    if (rline->mesi_state != MESI_INVALID && rline->tag != tag) {
+        if (rline->mesi_state == MESI_MODIFIED || rline->mesi_state == MESI_OWNED) {
+            memcpy(&ctx->bus.system_memory[BLOCK_ADDRESS(ctx, rline->tag, idx)], &CACHE_WORD(ctx, cache, fill_line, 0), block_bytes);
+        }
+        set_line_state(ctx, id, fill_line, rline->tag, MESI_INVALID);
+    }
+    bool has_copy = rline->mesi_state != MESI_INVALID;
+
+    bool shared = false;
+    int source = -1;
+    int source_line = -1;
+    for (int c = 0; c < ctx->config.core_count; c++) {
+        if (c == id) continue;
+        if (ctx->bus.sharers && !(ctx->bus.sharers[BLOCK_NUMBER(ctx, tag, idx)] & (1ULL << c))) continue;
+        Cache *other = ctx->bus.cpu_cache[c];
+        int snoop_line = find_cache_line(ctx, other, address);
+        if (snoop_line < 0) continue;
+        MESI_State state = other->tsram[snoop_line].mesi_state;
+        shared = true;
+
+        if (ctx->config.protocol == PROTOCOL_MOESI && (state == MESI_MODIFIED || state == MESI_OWNED)) {
+            source = c;
+            source_line = snoop_line;
+            if (!exclusive) set_line_state(ctx, c, snoop_line, tag, MESI_OWNED);
+        } else if (state == MESI_MODIFIED) {
+            memcpy(&ctx->bus.system_memory[BLOCK_ADDRESS(ctx, tag, idx)], &CACHE_WORD(ctx, other, snoop_line, 0), block_bytes);
+            if (!exclusive) set_line_state(ctx, c, snoop_line, tag, MESI_SHARED);
+        } else if (!exclusive && (state == MESI_EXCLUSIVE || state == MESI_FORWARD)) {
+            set_line_state(ctx, c, snoop_line, tag, MESI_SHARED);
+        }
+        if (exclusive) {
+            // The line keeps its data, so a supplier can still be copied below
+            set_line_state(ctx, c, snoop_line, tag, MESI_INVALID);
+            if (ctx->config.classify_misses) note_block_invalidated(ctx, other, BLOCK_NUMBER(ctx, tag, idx));
+        }
+    }
+
+    if (!has_copy) {
+        const uint32_t *data = source >= 0 ? &CACHE_WORD(ctx, ctx->bus.cpu_cache[source], source_line, 0)
+                                           : &ctx->bus.system_memory[BLOCK_ADDRESS(ctx, tag, idx)];
+        memcpy(&CACHE_WORD(ctx, cache, fill_line, 0), data, block_bytes);
+    }
+    MESI_State shared_state = ctx->config.protocol == PROTOCOL_MESIF ? MESI_FORWARD : MESI_SHARED;
+    set_line_state(ctx, id, fill_line, tag, exclusive ? MESI_MODIFIED : (shared ? shared_state : MESI_EXCLUSIVE));
+    touch_cache_line(ctx, cache, fill_line);
+    return fill_line;
+}
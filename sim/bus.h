@@ -1,8 +1,16 @@
 #pragma once
 #include "general_utils.h"
 
-extern SystemBus system_bus;
-
-void send_bus_read_request(Core* core, uint32_t address, bool exclusive);
-void init_bus(Core * core[CORE_COUNT]);
-void bus_handler();
\ No newline at end of file
+void send_bus_read_request(SimContext* ctx, Core* core, uint32_t address, bool exclusive);
+void send_bus_upgrade_request(SimContext* ctx, Core* core, uint32_t address);
+void send_prefetch_request(Core* core, uint32_t address);
+bool init_bus(SimContext* ctx, Core ** core);
+void free_bus(SimContext* ctx);
+void bus_handler(SimContext* ctx);
+// Fast-forward: count cycles in which the bus only runs down the memory latency
+void bus_skip_cooldown(SimContext* ctx, int count);
+// Functional warm-up (see functional.h): what a read miss, or with exclusive a
+// write the line does not allow, of address by core id leaves in the caches,
+// done at once: no bus cycles and no counters. Returns the line of id's cache
+// now holding the block.
+int bus_functional_access(SimContext* ctx, int id, uint32_t address, bool exclusive);
\ No newline at end of file
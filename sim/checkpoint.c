@@ -0,0 +1,296 @@
+#include "checkpoint.h"
+#include "pipeline.h"
+
+// Zero words in a row that end a run of a sparse image
+#define SPARSE_GAP 4
+#define CACHE_ARRAY_COUNT 5
+
+typedef struct {
+    char magic[CHECKPOINT_MAGIC_SIZE];
+    uint32_t config_size;
+    uint32_t core_size;
+    uint32_t bus_size;
+    uint32_t core_codec_size;
+    uint32_t bus_codec_size;
+} CheckpointHeader;
+
+typedef struct {
+    void* data;
+    size_t size;
+} CheckpointArray;
+
+static void fill_header(CheckpointHeader* header) {
+    memcpy(header->magic, CHECKPOINT_MAGIC, CHECKPOINT_MAGIC_SIZE);
+    header->config_size = (uint32_t)sizeof(SimConfig);
+    header->core_size = (uint32_t)sizeof(Core);
+    header->bus_size = (uint32_t)sizeof(SystemBus);
+    header->core_codec_size = (uint32_t)sizeof(CoreTraceCodec);
+    header->bus_codec_size = (uint32_t)sizeof(BusTraceCodec);
+}
+
+static bool write_block(FILE* file, const void* data, size_t size) {
+    return size == 0 || fwrite(data, 1, size, file) == size;
+}
+
+static bool read_block(FILE* file, void* data, size_t size) {
+    return size == 0 || fread(data, 1, size, file) == size;
+}
+
+// Runs of non-zero words as (start, count, words...), a zero count ends the image
+static bool write_sparse(FILE* file, const uint32_t* words, uint32_t count) {
+    bool ok = true;
+    uint32_t i = 0;
+    while (ok && i < count) {
+        if (words[i] == 0) {
+            i++;
+            continue;
+        }
+        uint32_t end = i;
+        uint32_t zeros = 0;
+        while (end < count && zeros < SPARSE_GAP) {
+            zeros = words[end] ? 0 : zeros + 1;
+            end++;
+        }
+        end -= zeros;
+        uint32_t run[2] = { i, end - i };
+        ok = write_block(file, run, sizeof(run)) && write_block(file, &words[i], (size_t)run[1] * sizeof(uint32_t));
+        i = end;
+    }
+    uint32_t last[2] = { 0, 0 };
+    return ok && write_block(file, last, sizeof(last));
+}
+
+static bool read_sparse(FILE* file, uint32_t* words, uint32_t count) {
+    memset(words, 0, (size_t)count * sizeof(uint32_t));
+    while (true) {
+        uint32_t run[2];
+        if (!read_block(file, run, sizeof(run))) return false;
+        if (run[1] == 0) return true;
+        if (run[0] >= count || run[1] > count - run[0]) return false;
+        if (!read_block(file, &words[run[0]], (size_t)run[1] * sizeof(uint32_t))) return false;
+    }
+}
+
+// The arrays init_cache() allocated for this configuration
+static int cache_arrays(SimContext* ctx, Cache* cache, CheckpointArray* arrays) {
+    int count = 0;
+    arrays[count].data = cache->dsram;
+    arrays[count++].size = (size_t)ctx->config.dsram_depth * sizeof(uint32_t);
+    arrays[count].data = cache->tsram;
+    arrays[count++].size = (size_t)ctx->config.tsram_depth * sizeof(TSRAM_Line);
+    if (cache->last_use) {
+        arrays[count].data = cache->last_use;
+        arrays[count++].size = (size_t)ctx->config.tsram_depth * sizeof(uint32_t);
+    }
+    if (cache->plru_bits) {
+        arrays[count].data = cache->plru_bits;
+        arrays[count++].size = (size_t)ctx->config.cache_sets * sizeof(uint64_t);
+    }
+    if (cache->prefetched) {
+        arrays[count].data = cache->prefetched;
+        arrays[count++].size = (size_t)ctx->config.tsram_depth * sizeof(uint8_t);
+    }
+    return count;
+}
+
+static uint32_t block_words(SimContext* ctx) {
+    return (uint32_t)(MEMIN_DEPTH >> ctx->config.offset_bits);
+}
+
+static uint32_t sharer_words(SimContext* ctx) {
+    return block_words(ctx) * 2;
+}
+
+static bool write_bus(SimContext* ctx, FILE* file) {
+    bool ok = write_block(file, (const void*)&ctx->bus, sizeof(SystemBus));
+    if (ctx->bus.inflight) {
+        ok = ok && write_block(file, ctx->bus.inflight, (size_t)ctx->config.bus_inflight * sizeof(BusTransaction));
+    }
+    if (ctx->bus.sharers) {
+        ok = ok && write_sparse(file, (const uint32_t*)ctx->bus.sharers, sharer_words(ctx));
+    }
+    if (ctx->bus.word_written) {
+        ok = ok && write_sparse(file, ctx->bus.word_written, MEMIN_DEPTH) &&
+                   write_sparse(file, ctx->bus.block_classes, block_words(ctx) * MISS_CLASS_COUNT);
+    }
+    return ok && write_sparse(file, ctx->bus.system_memory, MEMIN_DEPTH);
+}
+
+static bool read_bus(SimContext* ctx, FILE* file) {
+    // Keep this simulation's tables, only the state comes from the checkpoint
+    SystemBus tables = ctx->bus;
+    bool ok = read_block(file, (void*)&ctx->bus, sizeof(SystemBus));
+    ctx->bus.cpu_cache = tables.cpu_cache;
+    ctx->bus.bus_interface = tables.bus_interface;
+    ctx->bus.prefetch_interface = tables.prefetch_interface;
+    ctx->bus.system_memory = tables.system_memory;
+    ctx->bus.inflight = tables.inflight;
+    ctx->bus.sharers = tables.sharers;
+    ctx->bus.word_written = tables.word_written;
+    ctx->bus.block_classes = tables.block_classes;
+    if (!ok) return false;
+
+    if (ctx->bus.inflight &&
+        !read_block(file, ctx->bus.inflight, (size_t)ctx->config.bus_inflight * sizeof(BusTransaction))) return false;
+    if (ctx->bus.sharers && !read_sparse(file, (uint32_t*)ctx->bus.sharers, sharer_words(ctx))) return false;
+    if (ctx->bus.word_written &&
+        (!read_sparse(file, ctx->bus.word_written, MEMIN_DEPTH) ||
+         !read_sparse(file, ctx->bus.block_classes, block_words(ctx) * MISS_CLASS_COUNT))) return false;
+    return read_sparse(file, ctx->bus.system_memory, MEMIN_DEPTH);
+}
+
+static bool write_core(SimContext* ctx, FILE* file, Core* core) {
+    bool ok = write_block(file, core, sizeof(Core)) &&
+              write_block(file, core->imem, (size_t)ctx->config.imem_depth * sizeof(uint32_t));
+    CheckpointArray arrays[CACHE_ARRAY_COUNT];
+    int count = cache_arrays(ctx, &core->cache, arrays);
+    for (int a = 0; ok && a < count; a++) ok = write_block(file, arrays[a].data, arrays[a].size);
+    if (core->profile) ok = ok && write_block(file, core->profile, (size_t)ctx->config.imem_depth * sizeof(PcProfile));
+    if (core->cache.block_history) {
+        ok = ok && write_sparse(file, core->cache.block_history, block_words(ctx)) &&
+                   write_sparse(file, core->cache.block_misses, block_words(ctx)) &&
+                   write_block(file, core->cache.sharing_misses, (size_t)core->cache.sharing_miss_count * sizeof(PendingMiss));
+    }
+    return ok;
+}
+
+// Point a stage's instruction into program, it pointed into saved_program
+static bool rebase_stage(SimContext* ctx, PipelineStage* stage, const Instruction* saved_program, const Instruction* program) {
+    if (!stage->inst) return true;
+    uintptr_t index = ((uintptr_t)stage->inst - (uintptr_t)saved_program) / sizeof(Instruction);
+    if (index >= (uintptr_t)ctx->config.imem_depth) return false;
+    stage->inst = &program[index];
+    return true;
+}
+
+static bool read_core(SimContext* ctx, FILE* file, Core* core) {
+    Core saved;
+    if (!read_block(file, &saved, sizeof(saved)) || saved.id != core->id) return false;
+
+    // Keep this simulation's arrays, the saved program only locates the pipeline's instructions
+    const Instruction* saved_program = saved.program;
+    saved.imem = core->imem;
+    saved.program = core->program;
+    saved.profile = core->profile;
+    saved.cache.dsram = core->cache.dsram;
+    saved.cache.tsram = core->cache.tsram;
+    saved.cache.last_use = core->cache.last_use;
+    saved.cache.plru_bits = core->cache.plru_bits;
+    saved.cache.prefetched = core->cache.prefetched;
+    saved.cache.block_history = core->cache.block_history;
+    saved.cache.block_misses = core->cache.block_misses;
+    saved.cache.sharing_misses = NULL;
+    saved.cache.sharing_miss_capacity = 0;
+    *core = saved;
+
+    PipelineStage* stages[] = { &core->pipe.fetch, &core->pipe.decode, &core->pipe.execute, &core->pipe.mem, &core->pipe.wb };
+    for (int s = 0; s < 5; s++) {
+        if (!rebase_stage(ctx, stages[s], saved_program, core->program)) return false;
+    }
+
+    if (!read_block(file, core->imem, (size_t)ctx->config.imem_depth * sizeof(uint32_t))) return false;
+    predecode_imem(ctx, core);
+
+    CheckpointArray arrays[CACHE_ARRAY_COUNT];
+    int count = cache_arrays(ctx, &core->cache, arrays);
+    for (int a = 0; a < count; a++) {
+        if (!read_block(file, arrays[a].data, arrays[a].size)) return false;
+    }
+    if (core->profile && !read_block(file, core->profile, (size_t)ctx->config.imem_depth * sizeof(PcProfile))) return false;
+    if (!core->cache.block_history) return true;
+    if (!read_sparse(file, core->cache.block_history, block_words(ctx)) ||
+        !read_sparse(file, core->cache.block_misses, block_words(ctx))) return false;
+
+    // Coherence misses still waiting for their block
+    int pending = core->cache.sharing_miss_count;
+    core->cache.sharing_miss_count = 0;
+    if (pending <= 0) return pending == 0;
+    core->cache.sharing_misses = (PendingMiss*)malloc((size_t)pending * sizeof(PendingMiss));
+    if (!core->cache.sharing_misses) return false;
+    core->cache.sharing_miss_count = pending;
+    core->cache.sharing_miss_capacity = pending;
+    return read_block(file, core->cache.sharing_misses, (size_t)pending * sizeof(PendingMiss));
+}
+
+bool checkpoint_write(Simulator* sim, const char* path) {
+    SimContext* ctx = &sim->context;
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        perror(path);
+        return false;
+    }
+
+    int core_count = ctx->config.core_count;
+    CheckpointHeader header;
+    fill_header(&header);
+    bool ok = write_block(file, &header, sizeof(header)) &&
+              write_block(file, &ctx->config, sizeof(SimConfig)) &&
+              write_block(file, &sim->cycle, sizeof(sim->cycle)) &&
+              write_block(file, &sim->active_count, sizeof(sim->active_count)) &&
+              write_block(file, sim->active_cores, (size_t)sim->active_count * sizeof(int)) &&
+              write_bus(ctx, file);
+    for (int i = 0; ok && i < core_count; i++) ok = write_core(ctx, file, sim->cores[i]);
+
+    uint8_t binary = sim->files.binary_trace;
+    ok = ok && write_block(file, &binary, sizeof(binary));
+    for (int i = 0; ok && i <= core_count; i++) {
+        long long length = trace_sink_length(i < core_count ? sim->files.trace_sink[i] : sim->files.bustrace_sink);
+        ok = write_block(file, &length, sizeof(length));
+    }
+    ok = ok && write_block(file, sim->files.core_codec, (size_t)core_count * sizeof(CoreTraceCodec)) &&
+               write_block(file, &sim->files.bus_codec, sizeof(BusTraceCodec));
+
+    if (fclose(file) != 0) ok = false;
+    if (!ok) printf("%s: could not write the checkpoint\n", path);
+    return ok;
+}
+
+bool checkpoint_read(Simulator* sim, const char* path, long long* lengths) {
+    SimContext* ctx = &sim->context;
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        perror(path);
+        return false;
+    }
+
+    int core_count = ctx->config.core_count;
+    CheckpointHeader header, expected;
+    SimConfig config;
+    fill_header(&expected);
+    bool ok = read_block(file, &header, sizeof(header)) && memcmp(&header, &expected, sizeof(header)) == 0;
+    if (!ok) {
+        printf("%s: not a checkpoint of this simulator build\n", path);
+        fclose(file);
+        return false;
+    }
+    ok = read_block(file, &config, sizeof(config)) && memcmp(&config, &ctx->config, sizeof(config)) == 0;
+    if (!ok) {
+        printf("%s: the checkpoint was written with a different configuration\n", path);
+        fclose(file);
+        return false;
+    }
+
+    ok = read_block(file, &sim->cycle, sizeof(sim->cycle)) &&
+         read_block(file, &sim->active_count, sizeof(sim->active_count)) &&
+         sim->active_count >= 0 && sim->active_count <= core_count &&
+         read_block(file, sim->active_cores, (size_t)sim->active_count * sizeof(int)) &&
+         read_bus(ctx, file);
+    for (int i = 0; ok && i < core_count; i++) ok = read_core(ctx, file, sim->cores[i]);
+
+    uint8_t binary = 0;
+    ok = ok && read_block(file, &binary, sizeof(binary)) &&
+         read_block(file, lengths, (size_t)(core_count + 1) * sizeof(long long)) &&
+         read_block(file, sim->files.core_codec, (size_t)core_count * sizeof(CoreTraceCodec)) &&
+         read_block(file, &sim->files.bus_codec, sizeof(BusTraceCodec));
+    fclose(file);
+    if (!ok) {
+        printf("%s: truncated or corrupt checkpoint\n", path);
+        return false;
+    }
+
+    // Traces in the other format cannot be continued
+    if (binary != (uint8_t)sim->files.binary_trace) {
+        for (int i = 0; i <= core_count; i++) lengths[i] = 0;
+    }
+    return true;
+}
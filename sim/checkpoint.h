@@ -0,0 +1,23 @@
+#pragma once
+#include "simulator.h"
+
+// Binary checkpoints of a whole simulation (see sim_checkpoint()):
+//   header     magic and the sizes of the raw structs below
+//   SimConfig  a checkpoint only restores into the same configuration
+//   run        cycle and the active core list
+//   bus        SystemBus, its split bus / snoop filter / miss class tables,
+//              and main memory as runs of non-zero words
+//   cores      each Core with its imem, cache arrays, profile and miss history
+//   traces     binary flag, the length of every trace and the codec states
+// Structs are stored as they are in memory (pointers are fixed up on
+// restore), so checkpoints only move between builds of the same simulator.
+
+#define CHECKPOINT_MAGIC "MESICKP1"
+#define CHECKPOINT_MAGIC_SIZE 8
+
+bool checkpoint_write(Simulator* sim, const char* path);
+
+// Load the state saved in path into sim, which was created with the same
+// configuration. lengths gets the trace lengths to continue after (core
+// traces, then the bustrace), 0 for traces that have to start over.
+bool checkpoint_read(Simulator* sim, const char* path, long long* lengths);
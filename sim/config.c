@@ -0,0 +1,218 @@
+#include "config.h"
+#include <stddef.h>
+
+typedef struct {
+    const char* key;
+    size_t offset;
+    const char* const* names; // Optional names for the values 0, 1, ... (NULL terminated)
+} ConfigKey;
+
+static const char* const replacement_names[] = { "lru", "plru", "random", NULL };
+static const char* const protocol_names[] = { "mesi", "moesi", "mesif", NULL };
+static const char* const prefetch_names[] = { "none", "next_line", "stride", NULL };
+
+static const ConfigKey config_keys[] = {
+    { "core_count", offsetof(SimConfig, core_count), NULL },
+    { "imem_depth", offsetof(SimConfig, imem_depth), NULL },
+    { "dsram_depth", offsetof(SimConfig, dsram_depth), NULL },
+    { "block_size", offsetof(SimConfig, block_size), NULL },
+    { "bus_delay", offsetof(SimConfig, bus_delay), NULL },
+    { "snoop_filter", offsetof(SimConfig, snoop_filter), NULL },
+    { "cache_ways", offsetof(SimConfig, cache_ways), NULL },
+    { "replacement", offsetof(SimConfig, replacement), replacement_names },
+    { "split_bus", offsetof(SimConfig, split_bus), NULL },
+    { "bus_inflight", offsetof(SimConfig, bus_inflight), NULL },
+    { "bus_upgrade", offsetof(SimConfig, bus_upgrade), NULL },
+    { "protocol", offsetof(SimConfig, protocol), protocol_names },
+    { "forwarding", offsetof(SimConfig, forwarding), NULL },
+    { "mshrs", offsetof(SimConfig, mshrs), NULL },
+    { "store_buffer", offsetof(SimConfig, store_buffer), NULL },
+    { "prefetch", offsetof(SimConfig, prefetch), prefetch_names },
+    { "prefetch_degree", offsetof(SimConfig, prefetch_degree), NULL },
+    { "profile", offsetof(SimConfig, profile), NULL },
+    { "classify_misses", offsetof(SimConfig, classify_misses), NULL },
+};
+#define CONFIG_KEY_COUNT (sizeof(config_keys) / sizeof(config_keys[0]))
+
+static const ConfigKey* find_key(const char* key) {
+    for (size_t i = 0; i < CONFIG_KEY_COUNT; i++) {
+        if (strcmp(config_keys[i].key, key) == 0) return &config_keys[i];
+    }
+    return NULL;
+}
+
+static bool is_power_of_two(int value) {
+    return value > 0 && (value & (value - 1)) == 0;
+}
+
+static int log2_int(int value) {
+    int bits = 0;
+    while ((1 << bits) < value) bits++;
+    return bits;
+}
+
+void config_set_defaults(SimConfig* config) {
+    memset(config, 0, sizeof(*config));
+    config->core_count = CORE_COUNT;
+    config->imem_depth = IMEM_DEPTH;
+    config->dsram_depth = DSRAM_DEPTH;
+    config->block_size = CACHE_BLOCK_SIZE;
+    config->bus_delay = BUS_DELAY;
+    config->cache_ways = 1;
+    config->replacement = REPLACE_LRU;
+    config->bus_inflight = 4;
+    config->prefetch_degree = 1;
+}
+
+bool config_is_key(const char* key) {
+    return find_key(key) != NULL;
+}
+
+bool config_set(SimConfig* config, const char* key, const char* value) {
+    const ConfigKey* entry = find_key(key);
+    if (!entry) {
+        printf("Unknown configuration key %s\n", key);
+        return false;
+    }
+
+    int* field = (int*)((char*)config + entry->offset);
+    if (entry->names) {
+        for (int i = 0; entry->names[i]; i++) {
+            if (strcmp(entry->names[i], value) == 0) {
+                *field = i;
+                return true;
+            }
+        }
+    }
+
+    char* end;
+    long number = strtol(value, &end, 0);
+    if (end == value || *end != '\0' || number < 0 || number > (1L << 24)) {
+        printf("Invalid value %s for %s\n", value, key);
+        return false;
+    }
+    *field = (int)number;
+    return true;
+}
+
+// One "key value" pair per line, '#' starts a comment
+bool config_load_file(SimConfig* config, const char* path) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        perror(path);
+        return false;
+    }
+
+    char line[256];
+    int line_number = 0;
+    bool ok = true;
+    while (fgets(line, sizeof(line), file)) {
+        line_number++;
+        char* comment = strchr(line, '#');
+        if (comment) *comment = '\0';
+
+        char key[64], value[64], extra[2];
+        int fields = sscanf(line, "%63s %63s %1s", key, value, extra);
+        if (fields <= 0) continue; // Blank line
+        if (fields != 2 || !config_set(config, key, value)) {
+            printf("%s:%d: expected \"key value\"\n", path, line_number);
+            ok = false;
+        }
+    }
+    fclose(file);
+    return ok;
+}
+
+bool config_finalize(SimConfig* config) {
+    bool ok = true;
+
+    if (config->core_count < 1 || config->core_count > MAX_CORE_COUNT) {
+        printf("core_count must be between 1 and %d\n", MAX_CORE_COUNT);
+        ok = false;
+    }
+    // Binary traces store PCs in 16 bits
+    if (!is_power_of_two(config->imem_depth) || config->imem_depth > (1 << 16)) {
+        printf("imem_depth must be a power of two up to 65536\n");
+        ok = false;
+    }
+    if (!is_power_of_two(config->block_size)) {
+        printf("block_size must be a power of two\n");
+        ok = false;
+    }
+    if (!is_power_of_two(config->dsram_depth) || config->dsram_depth < config->block_size) {
+        printf("dsram_depth must be a power of two of at least one block\n");
+        ok = false;
+    }
+    if (config->snoop_filter != 0 && config->snoop_filter != 1) {
+        printf("snoop_filter must be 0 or 1\n");
+        ok = false;
+    }
+    if (config->split_bus != 0 && config->split_bus != 1) {
+        printf("split_bus must be 0 or 1\n");
+        ok = false;
+    }
+    if (config->bus_upgrade != 0 && config->bus_upgrade != 1) {
+        printf("bus_upgrade must be 0 or 1\n");
+        ok = false;
+    }
+    if (config->forwarding != 0 && config->forwarding != 1) {
+        printf("forwarding must be 0 or 1\n");
+        ok = false;
+    }
+    if (config->profile != 0 && config->profile != 1) {
+        printf("profile must be 0 or 1\n");
+        ok = false;
+    }
+    if (config->classify_misses != 0 && config->classify_misses != 1) {
+        printf("classify_misses must be 0 or 1\n");
+        ok = false;
+    }
+    if (config->mshrs < 0 || config->mshrs > MAX_MSHRS) {
+        printf("mshrs must be between 0 and %d\n", MAX_MSHRS);
+        ok = false;
+    }
+    if (config->store_buffer < 0 || config->store_buffer > MAX_STORE_BUFFER) {
+        printf("store_buffer must be between 0 and %d\n", MAX_STORE_BUFFER);
+        ok = false;
+    }
+    if (config->prefetch < PREFETCH_NONE || config->prefetch > PREFETCH_STRIDE) {
+        printf("prefetch must be none, next_line or stride\n");
+        ok = false;
+    }
+    if (config->prefetch_degree < 1 || config->prefetch_degree > MAX_PREFETCH_DEGREE) {
+        printf("prefetch_degree must be between 1 and %d\n", MAX_PREFETCH_DEGREE);
+        ok = false;
+    }
+    if (config->protocol < PROTOCOL_MESI || config->protocol > PROTOCOL_MESIF) {
+        printf("protocol must be mesi, moesi or mesif\n");
+        ok = false;
+    }
+    if (config->bus_inflight < 1 || config->bus_inflight > MAX_CORE_COUNT) {
+        printf("bus_inflight must be between 1 and %d\n", MAX_CORE_COUNT);
+        ok = false;
+    }
+    // PLRU keeps a set's tree (ways - 1 nodes) in 64 bits
+    if (!is_power_of_two(config->cache_ways) || config->cache_ways > 64 ||
+        config->cache_ways > config->dsram_depth / config->block_size) {
+        printf("cache_ways must be a power of two, at most 64 and at most the number of lines\n");
+        ok = false;
+    }
+    if (config->replacement < REPLACE_LRU || config->replacement > REPLACE_RANDOM) {
+        printf("replacement must be lru, plru or random\n");
+        ok = false;
+    }
+    if (!ok) return false;
+
+    config->tsram_depth = config->dsram_depth / config->block_size;
+    config->cache_sets = config->tsram_depth / config->cache_ways;
+    config->offset_bits = log2_int(config->block_size);
+    config->index_bits = log2_int(config->cache_sets);
+    config->tag_bits = ADDRESS_BITS - config->index_bits - config->offset_bits;
+    config->pc_mask = (uint32_t)(config->imem_depth - 1);
+
+    if (config->tag_bits < 1) {
+        printf("dsram_depth must be smaller than main memory\n");
+        return false;
+    }
+    return true;
+}
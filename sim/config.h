@@ -0,0 +1,21 @@
+#pragma once
+#include "general_utils.h"
+
+// Machine configuration: defaults, "key value" config files and command line
+// overrides. Keys are the SimConfig field names:
+//   core_count, imem_depth, dsram_depth, block_size, bus_delay, snoop_filter,
+//   cache_ways, replacement (lru, plru or random), split_bus, bus_inflight,
+//   bus_upgrade, protocol (mesi, moesi or mesif), forwarding, mshrs,
+//   store_buffer, prefetch (none, next_line or stride), prefetch_degree,
+//   profile, classify_misses
+// The command line spells them with dashes (--core-count 8).
+
+void config_set_defaults(SimConfig* config);
+
+// Returns false for unknown keys or invalid values
+bool config_is_key(const char* key);
+bool config_set(SimConfig* config, const char* key, const char* value);
+bool config_load_file(SimConfig* config, const char* path);
+
+// Validate the geometry and compute the derived fields, false if unusable
+bool config_finalize(SimConfig* config);
@@ -0,0 +1,90 @@
+#include "core_pool.h"
+#include "pipeline.h"
+
+// Thread t owns active cores t, t + threads, t + 2 * threads, ...
+static void run_share(CorePool* pool, int index) {
+    for (int a = index; a < pool->active_count; a += pool->threads) {
+        int i = pool->active[a];
+        pool->core_active[i] = run_core_stages(pool->context, pool->cores[i]);
+    }
+}
+
+static void worker_loop(void* arg) {
+    CorePoolWorker* worker = (CorePoolWorker*)arg;
+    CorePool* pool = worker->pool;
+    int index = worker->index;
+    free(worker);
+
+    while (true) {
+        sim_barrier_wait(&pool->start);
+        if (pool->stop) break;
+        run_share(pool, index);
+        sim_barrier_wait(&pool->done);
+    }
+}
+
+CorePool* core_pool_create(SimContext* ctx, Core** cores, int threads) {
+    CorePool* pool = (CorePool*)calloc(1, sizeof(CorePool));
+    if (!pool) return NULL;
+
+    if (threads < 1) threads = 1;
+    if (threads > ctx->config.core_count) threads = ctx->config.core_count;
+    pool->context = ctx;
+    pool->cores = cores;
+    pool->threads = threads;
+    if (threads == 1) return pool;
+
+    sim_barrier_init(&pool->start, threads);
+    sim_barrier_init(&pool->done, threads);
+    for (int t = 1; t < threads; t++) {
+        CorePoolWorker* worker = (CorePoolWorker*)malloc(sizeof(CorePoolWorker));
+        if (worker) {
+            worker->pool = pool;
+            worker->index = t;
+        }
+        if (!worker || !sim_thread_create(&pool->workers[t], worker_loop, worker)) {
+            // Could not start every worker: stop the ones we have and run serially
+            free(worker);
+            printf("core_pool_create(): could not start worker threads, running serially\n");
+            pool->threads = t;
+            core_pool_destroy(pool);
+            return core_pool_create(ctx, cores, 1);
+        }
+        pool->worker_started = t;
+    }
+    return pool;
+}
+
+void core_pool_destroy(CorePool* pool) {
+    if (!pool) return;
+
+    if (pool->threads > 1) {
+        pool->stop = true;
+        // Workers that did start are waiting at the start barrier. The barrier
+        // expects all threads, so release it from the main thread and join.
+        sim_mutex_lock(&pool->start.lock);
+        pool->start.count = pool->worker_started + 1;
+        sim_mutex_unlock(&pool->start.lock);
+        sim_barrier_wait(&pool->start);
+        for (int t = 1; t <= pool->worker_started; t++) {
+            sim_thread_join(pool->workers[t]);
+        }
+        sim_barrier_destroy(&pool->start);
+        sim_barrier_destroy(&pool->done);
+    }
+    free(pool);
+}
+
+bool core_pool_run_stages(CorePool* pool, const int* active, int active_count) {
+    pool->active = active;
+    pool->active_count = active_count;
+    if (pool->threads > 1) sim_barrier_wait(&pool->start);
+    run_share(pool, 0);
+    if (pool->threads > 1) sim_barrier_wait(&pool->done);
+
+    bool any_active = false;
+    for (int a = 0; a < active_count; a++) {
+        any_active = any_active || pool->core_active[active[a]];
+    }
+    return any_active;
+}
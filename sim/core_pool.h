@@ -0,0 +1,35 @@
+#pragma once
+#include "general_utils.h"
+#include "sim_thread.h"
+
+// Runs the per-core pipeline stages of a cycle on worker threads. Cores only
+// touch their own state during the stages (the bus and the other caches are
+// only changed by bus_handler() at the clock edge), so splitting the cores
+// between threads gives exactly the serial result.
+typedef struct {
+    SimContext* context;    // Passed to the stages on every thread
+    Core** cores;
+    int threads;            // Including the calling (main) thread
+    bool stop;
+    const int* active;      // This cycle's cores (halted and drained ones are left out)
+    int active_count;
+    bool core_active[MAX_CORE_COUNT];
+    SimBarrier start;       // Cycle begins: workers run their cores
+    SimBarrier done;        // All stages of the cycle finished
+    SimThread workers[MAX_CORE_COUNT];
+    int worker_started;
+} CorePool;
+
+typedef struct {
+    CorePool* pool;
+    int index;
+} CorePoolWorker;
+
+// threads is clamped to [1, core_count], 1 runs everything on the caller.
+// The workers run the stages of the simulation ctx belongs to.
+CorePool* core_pool_create(SimContext* ctx, Core** cores, int threads);
+void core_pool_destroy(CorePool* pool);
+
+// Run the stages of the active cores for this cycle, returns false once all
+// of them are done
+bool core_pool_run_stages(CorePool* pool, const int* active, int active_count);
@@ -0,0 +1,106 @@
+#include "fast_forward.h"
+#include "bus.h"
+#include "pipeline.h"
+
+static void take_snapshot(const Core* core, CoreSnapshot* snap) {
+    snap->pc = core->pc;
+    memcpy(snap->regs, core->regs, sizeof(snap->regs));
+    snap->pc_redirect_valid = core->pc_redirect_valid;
+    snap->pc_redirect = core->pc_redirect;
+    snap->stop_fetch = core->stop_fetch;
+    snap->halted = core->halted;
+    snap->pipe = core->pipe;
+    snap->has_pending_request = core->bus_interface.has_pending_request;
+    snap->request_done = core->bus_interface.request_done;
+    snap->stats = core->stats;
+}
+
+static bool stage_equal(const PipelineStage* a, const PipelineStage* b) {
+    return a->pc == b->pc && a->inst == b->inst && a->result == b->result &&
+           a->rs_val == b->rs_val && a->rt_val == b->rt_val && a->rd_val == b->rd_val &&
+           a->load_pending == b->load_pending &&
+           a->active == b->active && a->stall == b->stall;
+}
+
+// Field by field, struct padding makes memcmp() unreliable
+static bool core_unchanged(const Core* core, const CoreSnapshot* snap) {
+    return core->pc == snap->pc &&
+           memcmp(core->regs, snap->regs, sizeof(snap->regs)) == 0 &&
+           core->pc_redirect_valid == snap->pc_redirect_valid &&
+           core->pc_redirect == snap->pc_redirect &&
+           core->stop_fetch == snap->stop_fetch &&
+           core->halted == snap->halted &&
+           stage_equal(&core->pipe.fetch, &snap->pipe.fetch) &&
+           stage_equal(&core->pipe.decode, &snap->pipe.decode) &&
+           stage_equal(&core->pipe.execute, &snap->pipe.execute) &&
+           stage_equal(&core->pipe.mem, &snap->pipe.mem) &&
+           stage_equal(&core->pipe.wb, &snap->pipe.wb) &&
+           core->bus_interface.has_pending_request == snap->has_pending_request &&
+           core->bus_interface.request_done == snap->request_done;
+}
+
+// Only worth a snapshot while the bus is counting down and every running core
+// waits on it.
+static bool cycle_may_repeat(SimContext* ctx, Core** cores, const int* active, int active_count) {
+    // The MSHRs, the store buffer and the prefetchers are not part of the snapshot
+    if (ctx->config.mshrs > 0 || ctx->config.store_buffer > 0 || ctx->config.prefetch != PREFETCH_NONE) return false;
+    if (!ctx->bus.busy || ctx->bus.cooldown_timer <= 0) return false;
+    for (int a = 0; a < active_count; a++) {
+        const Core* core = cores[active[a]];
+        if (!core->pipe.mem.stall || core->bus_interface.request_done) return false;
+    }
+    return true;
+}
+
+void fast_forward_begin_cycle(SimContext* ctx, FastForward* ff, Core** cores, const int* active, int active_count) {
+    ff->armed = cycle_may_repeat(ctx, cores, active, active_count);
+    if (!ff->armed) return;
+
+    for (int a = 0; a < active_count; a++) {
+        take_snapshot(cores[active[a]], &ff->snap[active[a]]);
+    }
+}
+
+int fast_forward_cycles(SimContext* ctx, FastForward* ff, Core** cores, const int* active, int active_count) {
+    if (!ff->armed) return 0;
+    ff->armed = false;
+
+    // The next cycles only decrement the bus timer as long as it is non-zero
+    if (!cycle_may_repeat(ctx, cores, active, active_count)) return 0;
+
+    for (int a = 0; a < active_count; a++) {
+        int i = active[a];
+        if (!core_unchanged(cores[i], &ff->snap[i])) return 0;
+
+        const CoreStats* before = &ff->snap[i].stats;
+        const CoreStats* after = &cores[i]->stats;
+        CoreStats* delta = &ff->delta[i];
+        delta->cycles = after->cycles - before->cycles;
+        delta->instructions = after->instructions - before->instructions;
+        delta->read_hits = after->read_hits - before->read_hits;
+        delta->write_hits = after->write_hits - before->write_hits;
+        delta->read_misses = after->read_misses - before->read_misses;
+        delta->write_misses = after->write_misses - before->write_misses;
+        delta->decode_stall = after->decode_stall - before->decode_stall;
+        delta->mem_stall = after->mem_stall - before->mem_stall;
+    }
+    return ctx->bus.cooldown_timer;
+}
+
+void fast_forward_apply(SimContext* ctx, FastForward* ff, Core** cores, const int* active, int active_count, int count) {
+    for (int a = 0; a < active_count; a++) {
+        int i = active[a];
+        CoreStats* stats = &cores[i]->stats;
+        const CoreStats* delta = &ff->delta[i];
+        stats->cycles += delta->cycles * count;
+        stats->instructions += delta->instructions * count;
+        stats->read_hits += delta->read_hits * count;
+        stats->write_hits += delta->write_hits * count;
+        stats->read_misses += delta->read_misses * count;
+        stats->write_misses += delta->write_misses * count;
+        stats->decode_stall += delta->decode_stall * count;
+        stats->mem_stall += delta->mem_stall * count;
+        if (cores[i]->profile) profile_repeat_cycle(cores[i], delta, count);
+    }
+    bus_skip_cooldown(ctx, count);
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include "general_utils.h"
+
+// Skip-ahead over bus latency cycles.
+//
+// While the bus counts down cooldown_timer, a core that is stalled in MEM
+// re-evaluates the same frozen pipeline every cycle. If a whole cycle left
+// every running core exactly as it found it (only the counters moved), the
+// following cycles until the bus transfer starts are copies of it: they can be
+// applied in one step by scaling that cycle's counter deltas.
+
+typedef struct {
+    uint32_t pc;
+    int32_t regs[REGISTER_COUNT];
+    bool pc_redirect_valid;
+    uint32_t pc_redirect;
+    bool stop_fetch;
+    bool halted;
+    Pipeline pipe;
+    bool has_pending_request;
+    bool request_done;
+    CoreStats stats;
+} CoreSnapshot;
+
+typedef struct {
+    bool armed; // Snapshots were taken at the start of the current cycle
+    CoreSnapshot snap[MAX_CORE_COUNT];
+    CoreStats delta[MAX_CORE_COUNT];
+} FastForward;
+
+// Call before the stages of a cycle run
+void fast_forward_begin_cycle(SimContext* ctx, FastForward* ff, Core** cores, const int* active, int active_count);
+
+// Call after the clock edge: how many of the following cycles repeat the one that just ran
+int fast_forward_cycles(SimContext* ctx, FastForward* ff, Core** cores, const int* active, int active_count);
+
+// Apply count repeated cycles (counters and bus cooldown)
+void fast_forward_apply(SimContext* ctx, FastForward* ff, Core** cores, const int* active, int active_count, int count);
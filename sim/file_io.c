@@ -1,126 +1,501 @@
 #include "file_io.h"
+#include "hex_io.h"
+#include "assembler.h"
+#include "pipeline.h"
+#include "sim_thread.h"
+#include "config.h"
+
+static char* copy_name(const char* name) {
+    char* copy = (char*)malloc(strlen(name) + 1);
+    if (!copy) {
+        perror("get_arguments(): Memory allocation failed");
+        exit(1);
+    }
+    strcpy(copy, name);
+    return copy;
+}
+
+// name in dir, or in the working directory if dir is NULL
+static char* default_name(const char* dir, const char* format, int core) {
+    char name[64];
+    sprintf(name, format, core);
+    if (!dir) return copy_name(name);
+
+    char* path = (char*)malloc(strlen(dir) + strlen(name) + 2);
+    if (!path) {
+        perror("get_arguments(): Memory allocation failed");
+        exit(1);
+    }
+    sprintf(path, "%s/%s", dir, name);
+    return path;
+}
+
+static char** alloc_names(int count) {
+    char** names = (char**)calloc((size_t)count, sizeof(char*));
+    if (!names) {
+        perror("get_arguments(): Memory allocation failed");
+        exit(1);
+    }
+    return names;
+}
+
+// Config key of an option, "--core-count" is the config key "core_count"
+static bool option_key(const char* option, char key[64]) {
+    size_t len = strlen(option + 2);
+    if (len >= 64) return false;
+    for (size_t i = 0; i <= len; i++) key[i] = option[2 + i] == '-' ? '_' : option[2 + i];
+    return config_is_key(key);
+}
+
+bool parse_arguments(int argc, char* argv[], const char* input_dir, const char* output_dir,
+                     SimConfig* config, SimFiles* files, SimOptions* options) {
+    char** args = (char**)malloc((size_t)(argc + 1) * sizeof(char*));
+    int arg_count = 0;
+    bool ok = args != NULL;
+    char key[64];
+    const char* restore = NULL;
+    bool busstats = false;
+
+    memset(files, 0, sizeof(*files));
+    options->threads = 1;
+    options->fast_forward = true;
+    options->max_cycles = MAX_CYCLES;
+    options->checkpoint_every = 0;
+    options->checkpoint_on_timeout = false;
+    options->functional = 0;
+    config_set_defaults(config);
+
+    // Options ("--name") may appear anywhere, everything else is a file name
+    for (int i = 0; ok && i < argc; i++) {
+        if (strcmp(argv[i], "--binary-trace") == 0) {
+            files->binary_trace = true;
+        } else if (strcmp(argv[i], "--no-trace") == 0) {
+            files->no_trace = true;
+        } else if (strcmp(argv[i], "--memout-trim") == 0) {
+            files->memout_trim = true;
+        } else if (strcmp(argv[i], "--emit-imem") == 0) {
+            files->emit_imem = true;
+        } else if (strcmp(argv[i], "--busstats") == 0) {
+            busstats = true;
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            options->threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--no-fast-forward") == 0) {
+            options->fast_forward = false;
+        } else if (strcmp(argv[i], "--max-cycles") == 0 && i + 1 < argc) {
+            options->max_cycles = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--checkpoint-every") == 0 && i + 1 < argc) {
+            options->checkpoint_every = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--checkpoint-on-timeout") == 0) {
+            options->checkpoint_on_timeout = true;
+        } else if (strcmp(argv[i], "--functional") == 0 && i + 1 < argc) {
+            options->functional = atoll(argv[++i]);
+        } else if (strcmp(argv[i], "--restore") == 0 && i + 1 < argc) {
+            restore = argv[++i];
+        } else if (strcmp(argv[i], "--snoop-filter") == 0) {
+            config->snoop_filter = 1;
+        } else if (strcmp(argv[i], "--split-bus") == 0) {
+            config->split_bus = 1;
+        } else if (strcmp(argv[i], "--bus-upgrade") == 0) {
+            config->bus_upgrade = 1;
+        } else if (strcmp(argv[i], "--forwarding") == 0) {
+            config->forwarding = 1;
+        } else if (strcmp(argv[i], "--profile") == 0) {
+            config->profile = 1;
+        } else if (strcmp(argv[i], "--classify-misses") == 0) {
+            config->classify_misses = 1;
+        } else if (strcmp(argv[i], "--config") == 0 && i + 1 < argc) {
+            ok = config_load_file(config, argv[++i]);
+        } else if (strncmp(argv[i], "--", 2) == 0 && i + 1 < argc && option_key(argv[i], key)) {
+            ok = config_set(config, key, argv[++i]);
+        } else if (strncmp(argv[i], "--", 2) == 0) {
+            printf("Unknown option %s ignored\n", argv[i]);
+        } else {
+            args[arg_count++] = argv[i];
+        }
+    }
+
+    if (ok && (options->max_cycles < 1 || options->checkpoint_every < 0)) {
+        printf("--max-cycles must be at least 1 and --checkpoint-every at least 0\n");
+        ok = false;
+    }
+    if (ok && (options->functional < 0 || (options->functional > 0 && restore))) {
+        printf("--functional must be at least 0 and cannot be combined with --restore\n");
+        ok = false;
+    }
+    if (!ok || !config_finalize(config)) {
+        free(args);
+        return false;
+    }
+    int core_count = config->core_count;
+
+    files->core_count = core_count;
+    files->imem = alloc_names(core_count);
+    files->regout = alloc_names(core_count);
+    files->trace = alloc_names(core_count);
+    files->dsram = alloc_names(core_count);
+    files->tsram = alloc_names(core_count);
+    files->stats = alloc_names(core_count);
+    files->profile = alloc_names(core_count);
+    files->trace_sink = (TraceSink**)calloc((size_t)core_count, sizeof(TraceSink*));
+    files->core_codec = (CoreTraceCodec*)calloc((size_t)core_count, sizeof(CoreTraceCodec));
+    if (!files->trace_sink || !files->core_codec) {
+        perror("get_arguments(): Memory allocation failed");
+        exit(1);
+    }
+
+    files->checkpoint = default_name(output_dir, "checkpoint", 0);
+    for (int i = 0; i < core_count; i++) files->profile[i] = default_name(output_dir, "profile%d.txt", i);
+    files->misses = default_name(output_dir, "misses.txt", 0);
+    if (restore) files->restore = copy_name(restore);
+    if (busstats) files->busstats = default_name(output_dir, "busstats.json", 0);
 
-void get_arguments(int argc, char* argv[], SimFiles* files) {
     // defaults
-    if (argc < 28) {
-        files->imem[0] = "imem0.txt";
-        files->imem[1] = "imem1.txt";
-        files->imem[2] = "imem2.txt";
-        files->imem[3] = "imem3.txt";
-        files->memin = "memin.txt";
-        files->memout = "memout.txt";
-        files->regout[0] = "regout0.txt";
-        files->regout[1] = "regout1.txt";
-        files->regout[2] = "regout2.txt";
-        files->regout[3] = "regout3.txt";
-        files->trace[0] = "core0trace.txt";
-        files->trace[1] = "core1trace.txt";
-        files->trace[2] = "core2trace.txt";
-        files->trace[3] = "core3trace.txt";
-        files->bustrace = "bustrace.txt";
-        files->dsram[0] = "dsram0.txt";
-        files->dsram[1] = "dsram1.txt";
-        files->dsram[2] = "dsram2.txt";
-        files->dsram[3] = "dsram3.txt";
-        files->tsram[0] = "tsram0.txt";
-        files->tsram[1] = "tsram1.txt";
-        files->tsram[2] = "tsram2.txt";
-        files->tsram[3] = "tsram3.txt";
-        files->stats[0] = "stats0.txt";
-        files->stats[1] = "stats1.txt";
-        files->stats[2] = "stats2.txt";
-        files->stats[3] = "stats3.txt";
-        return;
+    if (arg_count < FILE_ARG_COUNT(core_count)) {
+        for (int i = 0; i < core_count; i++) {
+            files->imem[i] = default_name(input_dir, "imem%d.txt", i);
+            files->regout[i] = default_name(output_dir, "regout%d.txt", i);
+            files->trace[i] = default_name(output_dir, "core%dtrace.txt", i);
+            files->dsram[i] = default_name(output_dir, "dsram%d.txt", i);
+            files->tsram[i] = default_name(output_dir, "tsram%d.txt", i);
+            files->stats[i] = default_name(output_dir, "stats%d.txt", i);
+        }
+        files->memin = default_name(input_dir, "memin.txt", 0);
+        files->memout = default_name(output_dir, "memout.txt", 0);
+        files->bustrace = default_name(output_dir, "bustrace.txt", 0);
+        free(args);
+        return true;
     }
 
     // from command line
-    int idx = 1;
-    for (int i = 0; i < CORE_COUNT; i++) files->imem[i] = argv[idx++];
-    files->memin = argv[idx++];
-    files->memout = argv[idx++];
-    for (int i = 0; i < CORE_COUNT; i++) files->regout[i] = argv[idx++];
-    for (int i = 0; i < CORE_COUNT; i++) files->trace[i] = argv[idx++];
-    files->bustrace = argv[idx++];
-    for (int i = 0; i < CORE_COUNT; i++) files->dsram[i] = argv[idx++];
-    for (int i = 0; i < CORE_COUNT; i++) files->tsram[i] = argv[idx++];
-    for (int i = 0; i < CORE_COUNT; i++) files->stats[i] = argv[idx++];
+    int idx = 0;
+    for (int i = 0; i < core_count; i++) files->imem[i] = copy_name(args[idx++]);
+    files->memin = copy_name(args[idx++]);
+    files->memout = copy_name(args[idx++]);
+    for (int i = 0; i < core_count; i++) files->regout[i] = copy_name(args[idx++]);
+    for (int i = 0; i < core_count; i++) files->trace[i] = copy_name(args[idx++]);
+    files->bustrace = copy_name(args[idx++]);
+    for (int i = 0; i < core_count; i++) files->dsram[i] = copy_name(args[idx++]);
+    for (int i = 0; i < core_count; i++) files->tsram[i] = copy_name(args[idx++]);
+    for (int i = 0; i < core_count; i++) files->stats[i] = copy_name(args[idx++]);
+    free(args);
+    return true;
 }
 
-// Read imem[i] into struct
-void read_imem(SimFiles* files, Core* core[CORE_COUNT]) {
-    FILE* file;
+void get_arguments(int argc, char* argv[], SimConfig* config, SimFiles* files, SimOptions* options) {
+    if (!parse_arguments(argc - 1, argv + 1, NULL, NULL, config, files, options)) exit(1);
+}
+
+static void free_names(char** names, int count) {
+    if (!names) return;
+    for (int i = 0; i < count; i++) free(names[i]);
+    free(names);
+}
+
+void free_files(SimFiles* files) {
+    int core_count = files->core_count;
+    free_names(files->imem, core_count);
+    free_names(files->regout, core_count);
+    free_names(files->trace, core_count);
+    free_names(files->dsram, core_count);
+    free_names(files->tsram, core_count);
+    free_names(files->stats, core_count);
+    free_names(files->profile, core_count);
+    free(files->misses);
+    free(files->busstats);
+    free(files->checkpoint);
+    free(files->restore);
+    free(files->memin);
+    free(files->memout);
+    free(files->bustrace);
+    free(files->trace_sink);
+    free(files->core_codec);
+    memset(files, 0, sizeof(*files));
+}
+
+// name with its 4 character extension replaced
+static char* replace_extension(const char* name, const char* extension) {
+    size_t len = strlen(name) - 4;
+    char* path = (char*)malloc(len + 5);
+    if (!path) {
+        perror("read_imem(): Memory allocation failed");
+        exit(1);
+    }
+    memcpy(path, name, len);
+    strcpy(path + len, extension);
+    return path;
+}
+
+static bool file_exists(const char* path) {
+    FILE* file = fopen(path, "r");
+    if (!file) return false;
+    fclose(file);
+    return true;
+}
 
-    for (int i = 0; i < CORE_COUNT; i++) {
-        memset(core[i]->imem, 0, sizeof(core[i]->imem));
-        file = fopen(files->imem[i], "r");
-        if (file) {
-            for (int addr = 0; addr < IMEM_DEPTH; addr++) {
-                if (fscanf(file, "%08x", &core[i]->imem[addr]) == EOF) {
-                    break;
-                }
+// The source to assemble for an imem name, NULL to read it as hex
+static char* imem_source(const char* name) {
+    if (is_asm_file(name)) return copy_name(name);
+    size_t len = strlen(name);
+    if (len < 4 || strcmp(name + len - 4, ".txt") != 0 || file_exists(name)) return NULL;
+    char* source = replace_extension(name, ".asm");
+    if (file_exists(source)) return source;
+    free(source);
+    return NULL;
+}
+
+// Read imem[i] into struct
+bool read_imem(SimContext* ctx, SimFiles* files, Core** core) {
+    bool ok = true;
+    for (int i = 0; i < ctx->config.core_count; i++) {
+        char* source = imem_source(files->imem[i]);
+        if (!source) {
+            // A missing file leaves the imem zeroed
+            read_hex_file(files->imem[i], core[i]->imem, (size_t)ctx->config.imem_depth, 1);
+        } else {
+            long count = assemble_file(source, core[i]->imem, (size_t)ctx->config.imem_depth);
+            if (count < 0) ok = false;
+            if (count >= 0 && files->emit_imem) {
+                char* hex = replace_extension(source, ".txt");
+                if (!write_hex_file(hex, core[i]->imem, (size_t)count, 1)) perror(hex);
+                free(hex);
             }
-            fclose(file);
+            free(source);
         }
+        predecode_imem(ctx, core[i]);
     }
+    return ok;
 }
 
 // Read main mem
 void read_mainmem(SimFiles* files, uint32_t* main_memory) {
-    FILE* file;
+    // A missing file leaves the memory zeroed
+    read_hex_file(files->memin, main_memory, MEMIN_DEPTH, sim_cpu_count());
+}
 
-    memset(main_memory, 0, MEMIN_DEPTH * sizeof(uint32_t));
-    file = fopen(files->memin, "r");
-    if (file) {
-        int addr = 0;
-        while (fscanf(file, "%08x", &main_memory[addr]) != EOF && addr < MEMIN_DEPTH) {
-            addr++;
-        }
-        fclose(file);
+typedef struct {
+    int pc;
+    long long cycles;
+} ProfileRank;
+
+// Most cycles first, then by PC
+static int compare_rank(const void* a, const void* b) {
+    const ProfileRank* x = (const ProfileRank*)a;
+    const ProfileRank* y = (const ProfileRank*)b;
+    if (x->cycles != y->cycles) return x->cycles < y->cycles ? 1 : -1;
+    return x->pc - y->pc;
+}
+
+// One line per PC that did anything, sorted by the cycles spent at it:
+// retired instructions plus the cycles it stalled in DECODE and MEM
+static bool write_profile(SimContext* ctx, const char* path, const Core* core) {
+    ProfileRank* rank = (ProfileRank*)malloc((size_t)ctx->config.imem_depth * sizeof(ProfileRank));
+    if (!rank) return false;
+    int count = 0;
+    for (int pc = 0; pc < ctx->config.imem_depth; pc++) {
+        const PcProfile* p = &core->profile[pc];
+        long long cycles = (long long)p->retired + p->decode_stall + p->mem_stall;
+        if (cycles == 0 && p->stall_caused == 0 && p->misses == 0) continue;
+        rank[count].pc = pc;
+        rank[count++].cycles = cycles;
+    }
+    qsort(rank, (size_t)count, sizeof(ProfileRank), compare_rank);
+
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        free(rank);
+        return false;
     }
+    fprintf(file, "pc retired decode_stall mem_stall misses stall_caused producer\n");
+    for (int i = 0; i < count; i++) {
+        const PcProfile* p = &core->profile[rank[i].pc];
+        fprintf(file, "%03X %d %d %d %d %d ", rank[i].pc, p->retired, p->decode_stall,
+            p->mem_stall, p->misses, p->stall_caused);
+        if (p->producer >= 0) fprintf(file, "%03X\n", p->producer);
+        else fprintf(file, "---\n");
+    }
+    fclose(file);
+    free(rank);
+    return true;
 }
 
-// Write outputs files once at the end of main loop
-void write_outputs(SimFiles* files, Core* cores[CORE_COUNT], uint32_t* main_memory) {
-    FILE* file;
+static void write_json_grants(FILE* file, const long long* grants) {
+    fprintf(file, "{ \"rd\": %lld, \"rdx\": %lld, \"flush\": %lld, \"upgr\": %lld }",
+        grants[BUS_RD], grants[BUS_RDX], grants[BUS_FLUSH], grants[BUS_UPGR]);
+}
+
+// busstats.json: the bus cycle breakdown and totals, then one object per core
+static bool write_bus_stats(SimContext* ctx, const char* path) {
+    FILE* file = fopen(path, "w");
+    if (!file) return false;
+
+    const BusCycleStats* cycles = &ctx->bus.cycle_stats;
+    BusCoreStats total;
+    memset(&total, 0, sizeof(total));
+    for (int i = 0; i < ctx->config.core_count; i++) {
+        const BusCoreStats* s = &ctx->bus.core_stats[i];
+        total.wait_cycles += s->wait_cycles;
+        for (int cmd = 0; cmd <= BUS_UPGR; cmd++) total.grants[cmd] += s->grants[cmd];
+        total.prefetches += s->prefetches;
+        total.eviction_flushes += s->eviction_flushes;
+        total.snoop_flushes += s->snoop_flushes;
+        total.invalidations_sent += s->invalidations_sent;
+        total.exclusive_to_shared += s->exclusive_to_shared;
+    }
+    long long busy = cycles->address_cycles + cycles->cooldown_cycles + cycles->transfer_cycles;
 
-    // memout: write the full main memory image (2^21 words)
-    file = fopen(files->memout, "w");
-    if (!file) goto file_error;
-    for (int i = 0; i < MEMIN_DEPTH; i++) {
-        fprintf(file, "%08X\n", main_memory[i]);
+    fprintf(file, "{\n  \"bus\": {\n");
+    fprintf(file, "    \"cycles\": %lld,\n", busy + cycles->idle_cycles);
+    fprintf(file, "    \"busy_cycles\": %lld,\n", busy);
+    fprintf(file, "    \"address_cycles\": %lld,\n", cycles->address_cycles);
+    fprintf(file, "    \"cooldown_cycles\": %lld,\n", cycles->cooldown_cycles);
+    fprintf(file, "    \"transfer_cycles\": %lld,\n", cycles->transfer_cycles);
+    fprintf(file, "    \"idle_cycles\": %lld,\n", cycles->idle_cycles);
+    fprintf(file, "    \"wait_cycles\": %lld,\n", total.wait_cycles);
+    fprintf(file, "    \"grants\": ");
+    write_json_grants(file, total.grants);
+    fprintf(file, ",\n    \"prefetches\": %lld,\n", total.prefetches);
+    fprintf(file, "    \"eviction_flushes\": %lld,\n", total.eviction_flushes);
+    fprintf(file, "    \"snoop_flushes\": %lld,\n", total.snoop_flushes);
+    fprintf(file, "    \"invalidations\": %lld,\n", total.invalidations_sent);
+    fprintf(file, "    \"exclusive_to_shared\": %lld,\n", total.exclusive_to_shared);
+    fprintf(file, "    \"cache_transfers\": %lld,\n", ctx->bus.cache_transfers);
+    fprintf(file, "    \"memory_reads\": %lld,\n", ctx->bus.memory_reads);
+    fprintf(file, "    \"upgrades\": %lld,\n", ctx->bus.upgrades);
+    fprintf(file, "    \"snoop_probes\": %lld,\n", ctx->bus.snoop_probes);
+    fprintf(file, "    \"snoop_probes_avoided\": %lld\n", ctx->bus.snoop_probes_avoided);
+    fprintf(file, "  },\n  \"cores\": [\n");
+    for (int i = 0; i < ctx->config.core_count; i++) {
+        const BusCoreStats* s = &ctx->bus.core_stats[i];
+        fprintf(file, "    { \"core\": %d, \"wait_cycles\": %lld, \"grants\": ", i, s->wait_cycles);
+        write_json_grants(file, s->grants);
+        fprintf(file, ", \"prefetches\": %lld, \"eviction_flushes\": %lld, \"snoop_flushes\": %lld, "
+            "\"invalidations_sent\": %lld, \"invalidations_received\": %lld, \"exclusive_to_shared\": %lld }%s\n",
+            s->prefetches, s->eviction_flushes, s->snoop_flushes, s->invalidations_sent,
+            s->invalidations_received, s->exclusive_to_shared, i + 1 < ctx->config.core_count ? "," : "");
     }
+    fprintf(file, "  ]\n}\n");
     fclose(file);
-    
+    return true;
+}
 
-    for (int i = 0; i < CORE_COUNT; i++) {
+#define MISS_REPORT_BLOCKS 16 // Worst blocks listed, overall and per core
 
-        // regout
-        file = fopen(files->regout[i], "w");
-        if (!file) goto file_error;
-        for (int r = 2; r < REGISTER_COUNT; r++) { // R2 to R15
-            fprintf(file, "%08X\n", cores[i]->regs[r]);
+static const char* const miss_class_names[MISS_CLASS_COUNT] = {
+    "compulsory", "conflict", "true_sharing", "false_sharing", "upgrade"
+};
+
+typedef struct {
+    uint32_t block;
+    uint32_t misses;
+} BlockRank;
+
+// Most misses first, then by address
+static int compare_block_rank(const void* a, const void* b) {
+    const BlockRank* x = (const BlockRank*)a;
+    const BlockRank* y = (const BlockRank*)b;
+    if (x->misses != y->misses) return x->misses < y->misses ? 1 : -1;
+    return x->block < y->block ? -1 : x->block > y->block;
+}
+
+// Blocks with misses in counts (stride counters per block, summed), worst first
+static int rank_blocks(SimContext* ctx, BlockRank* rank, const uint32_t* counts, int stride) {
+    int count = 0;
+    uint32_t blocks = (uint32_t)(MEMIN_DEPTH >> ctx->config.offset_bits);
+    for (uint32_t block = 0; block < blocks; block++) {
+        uint32_t misses = 0;
+        for (int i = 0; i < stride; i++) misses += counts[(size_t)block * stride + i];
+        if (misses == 0) continue;
+        rank[count].block = block;
+        rank[count++].misses = misses;
+    }
+    qsort(rank, (size_t)count, sizeof(BlockRank), compare_block_rank);
+    return count;
+}
+
+static void write_class_header(FILE* file, const char* first) {
+    fprintf(file, "%s", first);
+    for (int c = 0; c < MISS_CLASS_COUNT; c++) fprintf(file, " %s", miss_class_names[c]);
+    fprintf(file, "\n");
+}
+
+// misses.txt: the misses of every core by MissClass, then the blocks with the
+// most misses (block word address in hex), overall by class and per core
+static bool write_miss_report(SimContext* ctx, const char* path, Core** cores) {
+    BlockRank* rank = (BlockRank*)malloc((MEMIN_DEPTH >> ctx->config.offset_bits) * sizeof(BlockRank));
+    if (!rank) return false;
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        free(rank);
+        return false;
+    }
+
+    int total[MISS_CLASS_COUNT] = { 0 };
+    write_class_header(file, "core");
+    for (int i = 0; i < ctx->config.core_count; i++) {
+        fprintf(file, "%d", i);
+        for (int c = 0; c < MISS_CLASS_COUNT; c++) {
+            fprintf(file, " %d", cores[i]->cache.misses_by_class[c]);
+            total[c] += cores[i]->cache.misses_by_class[c];
         }
-        fclose(file);
+        fprintf(file, "\n");
+    }
+    fprintf(file, "all");
+    for (int c = 0; c < MISS_CLASS_COUNT; c++) fprintf(file, " %d", total[c]);
+    fprintf(file, "\n\n");
 
-        // dsram
-        file = fopen(files->dsram[i], "w");
-        if (!file) goto file_error;
-        for (int line = 0; line < TSRAM_DEPTH; line++) {
-            for (int word = 0; word < CACHE_BLOCK_SIZE; word++) {
-                fprintf(file, "%08X\n", cores[i]->cache.dsram[line].word[word]);
-            }
+    write_class_header(file, "block misses");
+    int count = rank_blocks(ctx, rank, ctx->bus.block_classes, MISS_CLASS_COUNT);
+    for (int i = 0; i < count && i < MISS_REPORT_BLOCKS; i++) {
+        const uint32_t* classes = &ctx->bus.block_classes[(size_t)rank[i].block * MISS_CLASS_COUNT];
+        fprintf(file, "%06X %u", rank[i].block << ctx->config.offset_bits, rank[i].misses);
+        for (int c = 0; c < MISS_CLASS_COUNT; c++) fprintf(file, " %u", classes[c]);
+        fprintf(file, "\n");
+    }
+
+    fprintf(file, "\ncore block misses\n");
+    for (int i = 0; i < ctx->config.core_count; i++) {
+        count = rank_blocks(ctx, rank, cores[i]->cache.block_misses, 1);
+        for (int b = 0; b < count && b < MISS_REPORT_BLOCKS; b++) {
+            fprintf(file, "%d %06X %u\n", i, rank[b].block << ctx->config.offset_bits, rank[b].misses);
         }
-        fclose(file);
-        
+    }
+    fclose(file);
+    free(rank);
+    return true;
+}
 
-        // tsram
-        file = fopen(files->tsram[i], "w");
-        if (!file) goto file_error;
-        for (int line = 0; line < TSRAM_DEPTH; line++) {
-            uint32_t val = (cores[i]->cache.tsram[line].mesi_state << 12) | (cores[i]->cache.tsram[line].tag & 0xFFF);
-            fprintf(file, "%08X\n", val);
+// Write outputs files once at the end of main loop
+void write_outputs(SimContext* ctx, SimFiles* files, Core** cores, uint32_t* main_memory) {
+    FILE* file;
+    uint32_t* tsram = NULL;
+    int threads = sim_cpu_count();
+
+    // memout: write the full main memory image (2^21 words), or only up to the
+    // last non-zero word with --memout-trim
+    size_t memout_len = MEMIN_DEPTH;
+    if (files->memout_trim) memout_len = hex_trimmed_length(main_memory, MEMIN_DEPTH);
+    if (!write_hex_file(files->memout, main_memory, memout_len, threads)) goto file_error;
+
+    if (files->busstats && !write_bus_stats(ctx, files->busstats)) goto file_error;
+    if (ctx->config.classify_misses && !write_miss_report(ctx, files->misses, cores)) goto file_error;
+
+    tsram = (uint32_t*)malloc((size_t)ctx->config.tsram_depth * sizeof(uint32_t));
+    if (!tsram) goto file_error;
+
+    for (int i = 0; i < ctx->config.core_count; i++) {
+
+        // regout: R2 to R15
+        if (!write_hex_file(files->regout[i], (const uint32_t*)&cores[i]->regs[2], REGISTER_COUNT - 2, 1)) goto file_error;
+
+        // dsram
+        if (!write_hex_file(files->dsram[i], cores[i]->cache.dsram, (size_t)ctx->config.dsram_depth, 1)) goto file_error;
+
+        // tsram: MESI state above the tag bits (bits 13:12 with the default geometry)
+        uint32_t tag_mask = (1u << ctx->config.tag_bits) - 1;
+        for (int line = 0; line < ctx->config.tsram_depth; line++) {
+            tsram[line] = ((uint32_t)cores[i]->cache.tsram[line].mesi_state << ctx->config.tag_bits) | (cores[i]->cache.tsram[line].tag & tag_mask);
         }
-        fclose(file);
+        if (!write_hex_file(files->tsram[i], tsram, (size_t)ctx->config.tsram_depth, 1)) goto file_error;
 
         // stats
         file = fopen(files->stats[i], "w");
@@ -134,73 +509,176 @@ void write_outputs(SimFiles* files, Core* cores[CORE_COUNT], uint32_t* main_memo
         fprintf(file, "decode_stall %d\n", cores[i]->stats.decode_stall); 
         fprintf(file, "mem_stall %d\n", cores[i]->stats.mem_stall);      
         fclose(file);
+
+        if (ctx->config.profile && !write_profile(ctx, files->profile[i], cores[i])) goto file_error;
     }
 
+    free(tsram);
     return;
     file_error:
+    free(tsram);
     perror("write_output(): Error opening file!");
 }
 
-// Write outputs each clock cycle (main loop iteration)
-void log_bus_trace(SimFiles* files, int cycle) {
-    if (system_bus.bus_cmd == BUS_NOCMD) return;
-
-    FILE* fp = fopen(files->bustrace, "a");
-    if (fp) {
-        fprintf(fp, "%d %X %X %06X %08X %X\n", 
-            cycle, 
-            system_bus.bus_orig_id, 
-            system_bus.bus_cmd, 
-            system_bus.bus_addr & 0xFFFFF, 
-            system_bus.bus_data, 
-            system_bus.bus_shared);
-        fclose(fp);
-    }
-}
-
-
-void log_core_trace(SimFiles* files, Core* cores[CORE_COUNT], int cycle) {
-    for (int i = 0; i < CORE_COUNT; i++) {
-        // Print as long as at least one pipeline stage is active.
-        if (cores[i]->halted &&
-            !cores[i]->pipe.fetch.active && !cores[i]->pipe.decode.active &&
-            !cores[i]->pipe.execute.active && !cores[i]->pipe.mem.active &&
-            !cores[i]->pipe.wb.active) {
-            continue;
+// Open a trace, continuing it after length bytes if possible (see reopen_traces())
+static TraceSink* open_trace(SimFiles* files, const char* path, const char* magic, long long length, bool* continued) {
+    *continued = false;
+    if (length > 0) {
+        TraceSink* sink = trace_sink_continue(files->trace_writer, path, length);
+        if (sink) {
+            *continued = true;
+            return sink;
         }
+        printf("%s is shorter than at the checkpoint, starting it over\n", path);
+    }
+    TraceSink* sink = trace_sink_open(files->trace_writer, path);
+    if (files->binary_trace) {
+        trace_sink_write(sink, magic, TRACE_MAGIC_SIZE);
+    }
+    return sink;
+}
 
-        FILE* fp = fopen(files->trace[i], "a");
-        if (fp) {
-            fprintf(fp, "%d ", cycle);
+void reopen_traces(SimFiles* files, const long long* lengths) {
+    int core_count = files->core_count;
+    bool continued;
+    if (files->no_trace) return;
+    files->trace_writer = trace_writer_create();
+    for (int i = 0; i < core_count; i++) {
+        files->trace_sink[i] = open_trace(files, files->trace[i], CORE_TRACE_MAGIC, lengths ? lengths[i] : 0, &continued);
+        if (!continued) core_trace_codec_init(&files->core_codec[i]);
+    }
+    files->bustrace_sink = open_trace(files, files->bustrace, BUS_TRACE_MAGIC, lengths ? lengths[core_count] : 0, &continued);
+    if (!continued) bus_trace_codec_init(&files->bus_codec);
+}
+
+// Open every per-cycle trace once (truncating it) for the whole run
+void open_traces(SimFiles* files) {
+    reopen_traces(files, NULL);
+}
 
-            // FETCH
-            if (cores[i]->pipe.fetch.active) fprintf(fp, "%03X ", cores[i]->pipe.fetch.pc);
-            else fprintf(fp, "--- ");
+// Flush and close the traces, must be called before exiting
+void close_traces(SimContext* ctx, SimFiles* files) {
+    for (int i = 0; i < ctx->config.core_count; i++) {
+        trace_sink_close(files->trace_sink[i]);
+        files->trace_sink[i] = NULL;
+    }
+    trace_sink_close(files->bustrace_sink);
+    files->bustrace_sink = NULL;
+    trace_writer_destroy(files->trace_writer);
+    files->trace_writer = NULL;
+}
 
-            // DECODE
-            if (cores[i]->pipe.decode.active) fprintf(fp, "%03X ", cores[i]->pipe.decode.pc);
-            else fprintf(fp, "--- ");
+static void build_bus_record(SimContext* ctx, int cycle, BusTraceRecord* rec) {
+    rec->cycle = cycle;
+    rec->orig_id = ctx->bus.bus_orig_id;
+    rec->cmd = ctx->bus.bus_cmd;
+    rec->addr = ctx->bus.bus_addr & 0xFFFFF;
+    rec->data = ctx->bus.bus_data;
+    rec->shared = ctx->bus.bus_shared;
+}
 
-            // EXEC
-            if (cores[i]->pipe.execute.active) fprintf(fp, "%03X ", cores[i]->pipe.execute.pc);
-            else fprintf(fp, "--- ");
+// Print as long as at least one pipeline stage is active.
+static bool core_traced(const Core* core) {
+    return !core->halted ||
+        core->pipe.fetch.active || core->pipe.decode.active ||
+        core->pipe.execute.active || core->pipe.mem.active ||
+        core->pipe.wb.active;
+}
 
-            // MEM
-            if (cores[i]->pipe.mem.active) fprintf(fp, "%03X ", cores[i]->pipe.mem.pc);
-            else fprintf(fp, "--- ");
+static void build_core_record(const Core* core, int cycle, CoreTraceRecord* rec) {
+    const PipelineStage* stages[TRACE_STAGE_COUNT] = {
+        &core->pipe.fetch, &core->pipe.decode, &core->pipe.execute,
+        &core->pipe.mem, &core->pipe.wb
+    };
+    rec->cycle = cycle;
+    rec->active = 0;
+    for (int s = 0; s < TRACE_STAGE_COUNT; s++) {
+        rec->pc[s] = (uint16_t)stages[s]->pc;
+        if (stages[s]->active) rec->active |= (uint8_t)(1 << s);
+    }
+    memcpy(rec->regs, core->regs, sizeof(rec->regs));
+}
 
-            // WB
-            if (cores[i]->pipe.wb.active) fprintf(fp, "%03X ", cores[i]->pipe.wb.pc);
-            else fprintf(fp, "--- ");
+// Write the text line of rec once per cycle in [rec->cycle, rec->cycle + count),
+// only the leading cycle number differs between the lines.
+static void write_repeated_line(TraceSink* sink, const char* line, int len, int first_cycle, int count) {
+    const char* rest = strchr(line, ' ');
+    size_t rest_len = (size_t)(len - (rest - line));
+    for (int c = 0; c < count; c++) {
+        char number[16];
+        int number_len = sprintf(number, "%d", first_cycle + c);
+        trace_sink_write(sink, number, (size_t)number_len);
+        trace_sink_write(sink, rest, rest_len);
+    }
+}
 
-            // Registers R2-R15
-            for (int r = 2; r < REGISTER_COUNT; r++) {
-                fprintf(fp, "%08X", cores[i]->regs[r]);
-                if (r < REGISTER_COUNT - 1) fprintf(fp, " "); 
-            }
+static void write_bus_record(SimFiles* files, BusTraceRecord* rec, int count) {
+    if (files->binary_trace) {
+        uint8_t record[TRACE_RECORD_MAX];
+        for (int c = 0; c < count; c++, rec->cycle++) {
+            int len = encode_bus_trace(&files->bus_codec, rec, record);
+            trace_sink_write(files->bustrace_sink, (const char*)record, (size_t)len);
+        }
+    } else {
+        char line[TRACE_LINE_MAX];
+        int len = format_bus_trace(line, rec);
+        if (count == 1) trace_sink_write(files->bustrace_sink, line, (size_t)len);
+        else write_repeated_line(files->bustrace_sink, line, len, rec->cycle, count);
+    }
+}
 
-            fprintf(fp, "\n");
-            fclose(fp);
+static void write_core_record(SimFiles* files, int core, CoreTraceRecord* rec, int count) {
+    TraceSink* sink = files->trace_sink[core];
+    if (files->binary_trace) {
+        uint8_t record[TRACE_RECORD_MAX];
+        for (int c = 0; c < count; c++, rec->cycle++) {
+            int len = encode_core_trace(&files->core_codec[core], rec, record);
+            trace_sink_write(sink, (const char*)record, (size_t)len);
         }
+    } else {
+        char line[TRACE_LINE_MAX];
+        int len = format_core_trace(line, rec);
+        if (count == 1) trace_sink_write(sink, line, (size_t)len);
+        else write_repeated_line(sink, line, len, rec->cycle, count);
     }
-}
\ No newline at end of file
+}
+
+// Write outputs each clock cycle (main loop iteration)
+void log_bus_trace(SimContext* ctx, SimFiles* files, int cycle) {
+    if (ctx->bus.bus_cmd == BUS_NOCMD || !files->bustrace_sink) return;
+
+    BusTraceRecord rec;
+    build_bus_record(ctx, cycle, &rec);
+    write_bus_record(files, &rec, 1);
+}
+
+
+void log_core_trace(SimFiles* files, Core** cores, const int* active, int active_count, int cycle) {
+    for (int a = 0; a < active_count; a++) {
+        int i = active[a];
+        if (!core_traced(cores[i]) || !files->trace_sink[i]) continue;
+
+        CoreTraceRecord rec;
+        build_core_record(cores[i], cycle, &rec);
+        write_core_record(files, i, &rec, 1);
+    }
+}
+
+// Fast-forwarded cycles: the machine state is the same in all of them, so
+// every trace gets count copies of its current line.
+void log_repeated_cycles(SimContext* ctx, SimFiles* files, Core** cores, const int* active, int active_count, int first_cycle, int count) {
+    for (int a = 0; a < active_count; a++) {
+        int i = active[a];
+        if (!core_traced(cores[i]) || !files->trace_sink[i]) continue;
+
+        CoreTraceRecord rec;
+        build_core_record(cores[i], first_cycle, &rec);
+        write_core_record(files, i, &rec, count);
+    }
+
+    if (ctx->bus.bus_cmd != BUS_NOCMD && files->bustrace_sink) {
+        BusTraceRecord rec;
+        build_bus_record(ctx, first_cycle, &rec);
+        write_bus_record(files, &rec, count);
+    }
+}
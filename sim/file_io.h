@@ -1,28 +1,82 @@
 #pragma once
 #include "general_utils.h"
+#include "trace_sink.h"
+#include "trace_format.h"
 #include <stdlib.h>
 
-extern SystemBus system_bus;
+// Number of file names given on the command line (otherwise defaults are used):
+// imem, regout, trace, dsram, tsram and stats per core, plus memin, memout and bustrace
+#define FILE_ARG_COUNT(core_count) (6 * (core_count) + 3)
 
 // File management
+// Per-core arrays have core_count entries, all names are owned by SimFiles
+// and released by free_files()
 typedef struct {
-    char* imem[CORE_COUNT];
+    int core_count;
+    char** imem;      // Hex images, or .asm sources (see read_imem())
     char* memin;
     char* memout;
-    char* regout[CORE_COUNT];
-    char* trace[CORE_COUNT];
+    char** regout;
+    char** trace;
     char* bustrace;
-    char* dsram[CORE_COUNT];
-    char* tsram[CORE_COUNT];
-    char* stats[CORE_COUNT];
+    char** dsram;
+    char** tsram;
+    char** stats;
+    char** profile;   // profile%d.txt next to the other outputs (config.profile only)
+    char* misses;     // misses.txt next to the other outputs (config.classify_misses only)
+    bool memout_trim; // --memout-trim: stop memout after the last non-zero word
+    bool emit_imem;   // --emit-imem: write the hex image of every assembled program
+    char* busstats;   // --busstats: bus and coherence counters (JSON), NULL if not wanted
+    char* checkpoint; // Checkpoints are written to <checkpoint><cycle>.bin
+    char* restore;    // --restore file: continue from a checkpoint, NULL to start from memin
+
+    // Open trace outputs (see open_traces())
+    bool binary_trace; // --binary-trace: delta encoded traces, see trace_format.h
+    bool no_trace;     // --no-trace: no core / bus traces at all
+    TraceWriter* trace_writer;
+    TraceSink** trace_sink;
+    TraceSink* bustrace_sink;
+    CoreTraceCodec* core_codec;
+    BusTraceCodec bus_codec;
 } SimFiles;
 
+// Simulation options (command line "--name value" flags)
+typedef struct {
+    int threads;       // --threads N: run the per-core stages on N threads (1 = serial)
+    bool fast_forward; // Skip over bus cooldown cycles, disable with --no-fast-forward
+    int max_cycles;    // --max-cycles N: stop a run that has not halted after N cycles
+    int checkpoint_every;       // --checkpoint-every N: checkpoint every N cycles (0 = never)
+    bool checkpoint_on_timeout; // --checkpoint-on-timeout: checkpoint when max_cycles is hit
+    long long functional;       // --functional N: warm up with N instructions per core (see functional.h)
+} SimOptions;
+
 // Function Declarations
-void get_arguments(int argc, char* argv[], SimFiles* files);
-void read_imem(SimFiles* files, Core* core[CORE_COUNT]); // Changed to Core*[] to match main
+// Parses the arguments (without the program name) into config (--config file,
+// --core-count etc.), files and options. Default input names (imem, memin) are
+// looked up in input_dir and default output names go to output_dir, NULL for
+// the working directory. Returns false on a bad configuration.
+bool parse_arguments(int argc, char* argv[], const char* input_dir, const char* output_dir,
+                     SimConfig* config, SimFiles* files, SimOptions* options);
+// Command line version of parse_arguments(), exits on a bad configuration
+void get_arguments(int argc, char* argv[], SimConfig* config, SimFiles* files, SimOptions* options);
+void free_files(SimFiles* files);
+// An imem name ending in .asm is assembled (see assembler.h), and so is the
+// .asm next to a missing .txt (imem0.asm for imem0.txt). With emit_imem the
+// assembled program is also written as that .txt. False if one does not assemble.
+bool read_imem(SimContext* ctx, SimFiles* files, Core** core); // Changed to Core*[] to match main
 void read_mainmem(SimFiles* files, uint32_t* main_memory);
-void write_outputs(SimFiles* files, Core* cores[CORE_COUNT], uint32_t* main_memory);
+void write_outputs(SimContext* ctx, SimFiles* files, Core** cores, uint32_t* main_memory);
+
+// Trace files stay open for the whole run, close_traces() flushes them
+void open_traces(SimFiles* files);
+// Restored run (see checkpoint.h): continue each trace after its length at the
+// checkpoint (core traces, then the bustrace), with the codec state in files.
+// A trace that is missing or shorter than that is started over.
+void reopen_traces(SimFiles* files, const long long* lengths);
+void close_traces(SimContext* ctx, SimFiles* files);
 
 // Trace Functions (Called every cycle)
-void log_bus_trace(SimFiles* files, int cycle);
-void log_core_trace(SimFiles* files, Core* cores[CORE_COUNT], int cycle);
\ No newline at end of file
+void log_bus_trace(SimContext* ctx, SimFiles* files, int cycle);
+// Only the active cores are logged: halted and drained ones print nothing
+void log_core_trace(SimFiles* files, Core** cores, const int* active, int active_count, int cycle);
+void log_repeated_cycles(SimContext* ctx, SimFiles* files, Core** cores, const int* active, int active_count, int first_cycle, int count);
\ No newline at end of file
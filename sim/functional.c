@@ -0,0 +1,125 @@
+#include "functional.h"
+#include "memory.h"
+#include "bus.h"
+
+// Where a core is in its program
+typedef struct {
+    uint32_t pc;      // Next instruction
+    uint32_t next_pc; // The one after it, the target once a branch was taken
+    long long left;   // Instructions still to run
+} FunctionalCore;
+
+static uint32_t functional_load(SimContext* ctx, Core* core, uint32_t address) {
+    Cache* cache = &core->cache;
+    int line = find_cache_line(ctx, cache, address);
+    if (line >= 0) touch_cache_line(ctx, cache, line);
+    else line = bus_functional_access(ctx, core->id, address, false);
+    return CACHE_WORD(ctx, cache, line, CACHE_OFFSET(ctx, address));
+}
+
+static void functional_store(SimContext* ctx, Core* core, uint32_t address, uint32_t data) {
+    Cache* cache = &core->cache;
+    int line = find_cache_line(ctx, cache, address);
+    MESI_State state = line >= 0 ? cache->tsram[line].mesi_state : MESI_INVALID;
+    if (state == MESI_MODIFIED || state == MESI_EXCLUSIVE) {
+        touch_cache_line(ctx, cache, line);
+        cache->tsram[line].mesi_state = MESI_MODIFIED;
+    } else {
+        line = bus_functional_access(ctx, core->id, address, true);
+    }
+    CACHE_WORD(ctx, cache, line, CACHE_OFFSET(ctx, address)) = data;
+}
+
+// Run up to count instructions of core, returns how many ran (HALT included)
+static long long run_instructions(SimContext* ctx, Core* core, FunctionalCore* f, long long count) {
+    const Instruction* program = core->program;
+    int32_t* regs = core->regs;
+    uint32_t pc_mask = ctx->config.pc_mask;
+    uint32_t pc = f->pc;
+    uint32_t next_pc = f->next_pc;
+    long long done = 0;
+
+    while (done < count) {
+        const Instruction* inst = &program[pc];
+        int32_t rs = inst->rs != 1 ? regs[inst->rs] : inst->imm;
+        int32_t rt = inst->rt != 1 ? regs[inst->rt] : inst->imm;
+        int32_t rd = inst->rd != 1 ? regs[inst->rd] : inst->imm;
+        int32_t result = 0;
+        bool taken = false;
+        done++;
+
+        switch (inst->opcode) {
+            case OP_ADD: result = rs + rt; break;
+            case OP_SUB: result = rs - rt; break;
+            case OP_AND: result = rs & rt; break;
+            case OP_OR:  result = rs | rt; break;
+            case OP_XOR: result = rs ^ rt; break;
+            case OP_MUL: result = rs * rt; break;
+            case OP_SLL: result = rs << rt; break;
+            case OP_SRA: result = rs >> rt; break;
+            case OP_SRL: result = (int32_t)((uint32_t)rs >> rt); break;
+            case OP_BEQ: taken = rs == rt; break;
+            case OP_BNE: taken = rs != rt; break;
+            case OP_BLT: taken = rs < rt; break;
+            case OP_BGT: taken = rs > rt; break;
+            case OP_BLE: taken = rs <= rt; break;
+            case OP_BGE: taken = rs >= rt; break;
+            case OP_JAL:
+                taken = true;
+                result = (int32_t)((pc + 1) & pc_mask);
+                break;
+            case OP_LW: result = (int32_t)functional_load(ctx, core, (uint32_t)(rs + rt)); break;
+            case OP_SW: functional_store(ctx, core, (uint32_t)(rs + rt), (uint32_t)rd); break;
+            case OP_HALT:
+                core->halted = true;
+                core->stop_fetch = true;
+                f->pc = pc;
+                f->next_pc = next_pc;
+                return done;
+            default: break;
+        }
+        if (inst->writes_dst && inst->dst > 1) regs[inst->dst] = result;
+
+        pc = next_pc;
+        next_pc = taken ? (uint32_t)rd & pc_mask : (next_pc + 1) & pc_mask;
+    }
+    f->pc = pc;
+    f->next_pc = next_pc;
+    return done;
+}
+
+long long functional_run(SimContext* ctx, Core** cores, int core_count, long long instructions) {
+    FunctionalCore state[MAX_CORE_COUNT];
+    uint32_t pc_mask = ctx->config.pc_mask;
+    int running = 0;
+    for (int c = 0; c < core_count; c++) {
+        state[c].pc = cores[c]->pc & pc_mask;
+        state[c].next_pc = (state[c].pc + 1) & pc_mask;
+        state[c].left = cores[c]->halted ? 0 : instructions;
+        if (state[c].left > 0) running++;
+    }
+
+    long long total = 0;
+    while (running > 0) {
+        for (int c = 0; c < core_count; c++) {
+            FunctionalCore* f = &state[c];
+            if (f->left == 0) continue;
+            long long done = run_instructions(ctx, cores[c], f, f->left < FUNCTIONAL_QUANTUM ? f->left : FUNCTIONAL_QUANTUM);
+            total += done;
+            f->left = cores[c]->halted ? 0 : f->left - done;
+            if (f->left == 0) running--;
+        }
+    }
+
+    // Hand over to the pipeline: fetch resumes at pc, then goes on at next_pc
+    for (int c = 0; c < core_count; c++) {
+        Core* core = cores[c];
+        core->regs[0] = 0;
+        core->pc = state[c].pc;
+        if (state[c].next_pc != ((state[c].pc + 1) & pc_mask)) {
+            core->pc_redirect_valid = true;
+            core->pc_redirect = state[c].next_pc;
+        }
+    }
+    return total;
+}
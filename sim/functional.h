@@ -0,0 +1,23 @@
+#pragma once
+#include "general_utils.h"
+
+// Functional warm-up (--functional N).
+//
+// Before the cycle-accurate run, every core executes its first N instructions
+// at the ISA level: one instruction at a time over the predecoded program,
+// with the results of the pipeline (branch delay slot, JAL linking PC + 1, R1
+// reading as the instruction's own immediate) but no timing. Loads and stores
+// go through the caches, misses through bus_functional_access(), so the
+// caches, the coherence states and main memory are what the accesses leave
+// behind when the pipeline takes over. Cores take turns every
+// FUNCTIONAL_QUANTUM instructions, so cores waiting on each other progress.
+//
+// The warm-up is not part of the run's statistics, traces or cycle count:
+// the pipeline starts at cycle 0 with an empty pipe, at the next instruction
+// (a branch whose delay slot did not run yet is left pending in pc_redirect).
+// A core that executes HALT is halted from the start.
+
+#define FUNCTIONAL_QUANTUM 64
+
+// Returns the number of instructions executed, all cores together
+long long functional_run(SimContext* ctx, Core** cores, int core_count, long long instructions);
@@ -12,14 +12,60 @@
 #define DEBUG_PRINT(...) ;
 #endif
 
+// Machine geometry defaults (as defined in project spec), all of them can be
+// changed at startup, see SimConfig / config.c
 #define IMEM_DEPTH 1024
 #define MEMIN_DEPTH (1 << 21) // 2^21 words (as defined in project spec)
+#define ADDRESS_BITS 21
 #define DSRAM_DEPTH 512 
 #define CACHE_BLOCK_SIZE 8
 #define REGISTER_COUNT 16 
 #define TSRAM_DEPTH (DSRAM_DEPTH / CACHE_BLOCK_SIZE) // 64 lines
 #define CORE_COUNT 4
 #define BUS_DELAY 16
+#define MAX_CORE_COUNT 64 // Upper bound for core_count (core bitmaps are 64 bits)
+#define MAX_CYCLES 500000 // Safety limit for programs that never halt
+#define MAX_MSHRS 16
+#define MAX_STORE_BUFFER 16
+#define MAX_PREFETCH_DEGREE 8
+#define STRIDE_TABLE_SIZE 16  // Stride prefetcher entries, indexed by PC
+#define PREFETCH_QUEUE_SIZE 8 // Candidate blocks waiting for the bus
+
+typedef enum { REPLACE_LRU = 0, REPLACE_PLRU, REPLACE_RANDOM } ReplacementPolicy;
+typedef enum { PROTOCOL_MESI = 0, PROTOCOL_MOESI, PROTOCOL_MESIF } CoherenceProtocol;
+typedef enum { PREFETCH_NONE = 0, PREFETCH_NEXT_LINE, PREFETCH_STRIDE } PrefetchPolicy;
+
+// Runtime machine configuration. Set once per simulation (see sim_create()),
+// everything sized by the geometry is allocated from it.
+typedef struct {
+    int core_count;
+    int imem_depth;     // Power of two, the PC wraps at imem_depth
+    int dsram_depth;    // Words per cache, power of two
+    int block_size;     // Words per cache line, power of two
+    int bus_delay;      // Memory latency in cycles before the first word
+    int snoop_filter;   // 1: only probe the caches the sharer bitmaps name (see bus.c)
+    int cache_ways;     // Associativity, power of two (1 = direct-mapped)
+    int replacement;    // ReplacementPolicy, only used with more than one way
+    int split_bus;      // 1: split-transaction bus (see split_bus_handler())
+    int bus_inflight;   // Split bus: transactions between address and data phase
+    int bus_upgrade;    // 1: writes to SHARED lines send BUS_UPGR instead of BUS_RDX
+    int protocol;       // CoherenceProtocol
+    int forwarding;     // 1: bypass network in the pipeline (see forward_operand())
+    int mshrs;          // Non-blocking loads: MSHRs per core (0 = blocking cache, see memory.c)
+    int store_buffer;   // Store buffer entries per core (0 = stores write the cache in MEM)
+    int prefetch;       // PrefetchPolicy (see prefetch.c)
+    int prefetch_degree; // Blocks a prefetcher runs ahead
+    int profile;        // 1: per-PC profile of every core (see PcProfile)
+    int classify_misses; // 1: classify every miss, report the worst blocks (see miss_class.h)
+
+    // Derived by config_finalize()
+    int tsram_depth;    // Lines per cache (all ways)
+    int cache_sets;     // Lines per way
+    int offset_bits;
+    int index_bits;
+    int tag_bits;
+    uint32_t pc_mask;
+} SimConfig;
 
 typedef enum {
     OP_ADD = 0, OP_SUB, OP_AND, OP_OR, OP_XOR, OP_MUL, OP_SLL, OP_SRA, OP_SRL,
@@ -29,15 +75,22 @@ typedef enum {
 
 // MESI encoding MUST match the project spec (TSRAM bits 13:12):
 // 0: Invalid, 1: Shared, 2: Exclusive, 3: Modified
+// The MOESI / MESIF protocol modes add 4: Owned and 5: Forward.
 typedef enum {
     MESI_INVALID = 0,
     MESI_SHARED = 1,
     MESI_EXCLUSIVE = 2,
-    MESI_MODIFIED = 3
+    MESI_MODIFIED = 3,
+    MESI_OWNED = 4,     // MOESI: dirty, other copies may be SHARED, supplies the data
+    MESI_FORWARD = 5    // MESIF: clean, the one sharer that supplies the data
 } MESI_State;
-typedef enum { BUS_NOCMD = 0, BUS_RD, BUS_RDX, BUS_FLUSH } BusCmd;
+// BUS_UPGR (config.bus_upgrade only): SHARED -> MODIFIED, invalidates the
+// other copies without a data transfer
+typedef enum { BUS_NOCMD = 0, BUS_RD, BUS_RDX, BUS_FLUSH, BUS_UPGR } BusCmd;
 
 // Instruction & Registers
+// The whole imem is decoded once at load time (see predecode_imem()), the
+// pipeline only passes pointers into that table around.
 typedef struct {
     uint32_t binary_value; 
     Opcode opcode;        
@@ -45,13 +98,23 @@ typedef struct {
     uint8_t rs;            
     uint8_t rt;            
     int32_t imm;           
+
+    // Hazard masks: bit r set for registers R2-R15 only (R0/R1 never cause a hazard)
+    uint16_t src_mask;     // Registers read in DECODE
+    uint16_t dst_mask;     // Register written in WB
+    bool writes_dst;       // Writes dst in WB (also when dst is R0/R1)
+    uint8_t dst;           // RD, or R15 for JAL
 } Instruction;
 
 // Pipeline
 typedef struct {
     uint32_t pc;            
-    Instruction inst;       
+    const Instruction* inst; // Points into Core.program
     int32_t result;        
+    int32_t rs_val;          // Operands, read (or forwarded) in DECODE
+    int32_t rt_val;
+    int32_t rd_val;          // SW: the data to store (forwarding only)
+    bool load_pending;       // LW handed to an MSHR, its register is written when the data arrives
     bool active;            
     bool stall; // Helper to prevent stage from advancing
 } PipelineStage;
@@ -64,19 +127,57 @@ typedef struct {
     PipelineStage wb;
 } Pipeline;
 
+// Cause of a read / write miss (config.classify_misses only)
+typedef enum {
+    MISS_COMPULSORY = 0,    // First access of the core to the block
+    MISS_CONFLICT,          // The block was replaced in this cache (conflict or capacity)
+    MISS_TRUE_SHARING,      // Invalidated by another core, the missing word was written since
+    MISS_FALSE_SHARING,     // Invalidated by another core, only other words were written since
+    MISS_UPGRADE,           // Write to a SHARED (OWNED, FORWARD) copy
+    MISS_CLASS_COUNT
+} MissClass;
+
+// A miss noted in MEM / the store buffer (see miss_class.h)
+typedef struct {
+    uint32_t address;
+    MissClass miss_class;    // Coherence misses: MISS_TRUE_SHARING until resolved
+    uint32_t invalidated_at; // Coherence misses: cycle of the invalidation
+} PendingMiss;
+#define MAX_MISSES_PER_CYCLE 2 // A LW in MEM and the store buffer head
+
 // Memory & Cache
 typedef struct {
     uint32_t tag;   
     MESI_State mesi_state; 
 } TSRAM_Line;
 
+// Line l of a cache is set (l % cache_sets) of way (l / cache_sets), so
+// every way is its own contiguous TSRAM/DSRAM (see CACHE_LINE()).
+// DSRAM is tsram_depth lines of block_size words, line after line.
 typedef struct {
-    uint32_t word[CACHE_BLOCK_SIZE];
-} DSRAM_Line;
+    uint32_t * dsram;
+    TSRAM_Line * tsram;
 
-typedef struct {
-    DSRAM_Line dsram[TSRAM_DEPTH];     
-    TSRAM_Line tsram[TSRAM_DEPTH];   
+    // Replacement state
+    uint32_t * last_use;    // LRU: per line, use_clock of the last access
+    uint64_t * plru_bits;   // PLRU: per set, tree bits (node n is bit n)
+    uint32_t use_clock;
+    uint32_t random_state;  // RANDOM: xorshift state, seeded per core so runs repeat
+
+    // Prefetching (config.prefetch only)
+    uint8_t * prefetched;   // Per line: filled by a prefetch, no demand access yet
+    int prefetch_issued;
+    int prefetch_useful;    // Prefetched lines a LW / SW used
+    int prefetch_late;      // Prefetches a demand miss had to wait for
+    int prefetch_useless;   // Prefetched lines invalidated or replaced unused
+
+    // Miss classification (config.classify_misses only, see miss_class.h)
+    uint32_t * block_history; // Per memory block: BLOCK_* state in this cache
+    uint32_t * block_misses;  // Per memory block: misses of this cache
+    int misses_by_class[MISS_CLASS_COUNT];
+    PendingMiss * sharing_misses; // Coherence misses waiting for their block to come back
+    int sharing_miss_count;
+    int sharing_miss_capacity;
 } Cache;
 
 // Status
@@ -89,6 +190,15 @@ typedef struct {
     int write_misses;
     int decode_stall; 
     int mem_stall;    
+
+    // config.mshrs only (not part of the stats file)
+    int miss_cycles;         // Cycles with at least one MSHR in use
+    int miss_progress;       // ... of which an instruction left DECODE
+    long long mshr_occupancy; // MSHRs in use, summed over the cycles
+
+    // config.store_buffer only
+    int sb_stores;           // Stores that went into the store buffer
+    int sb_forwards;         // Loads served from the store buffer
 } CoreStats;
 
 // Bus Structures
@@ -102,9 +212,67 @@ typedef struct {
 typedef struct {
     bool has_pending_request;
     BusRequest request;
+    bool request_issued; // Address phase done, waiting for the data
     bool request_done; // Flag set by bus when operation completes
 } BusInterface;
 
+// A granted bus operation, from its address phase to the last data word
+typedef struct {
+    int orig_id;          // Requester, or the flushing core
+    BusCmd cmd;
+    uint32_t addr;
+    int line;             // Line of orig_id's cache the data goes to / comes from
+    int source;           // RD/RDX: cache supplying the data, -1 for main memory
+    bool shared;          // bus_shared as seen in the address phase
+    int ready_timer;      // Split bus: cycles until the data phase may start
+    long sequence;        // Split bus: address phase order
+    bool prefetch;        // Request of a prefetch interface
+} BusTransaction;
+
+// Miss status holding register (config.mshrs only): a block being
+// fetched for loads that already went on down the pipeline
+typedef struct {
+    bool valid;
+    bool issued;             // Its BUS_RD is the core's bus request
+    uint32_t address;        // Address of the first load of the block
+    uint16_t targets;        // Registers waiting for a word of the block
+    uint8_t target_offset[REGISTER_COUNT];
+} Mshr;
+
+// Store buffer entry (config.store_buffer only)
+typedef struct {
+    uint32_t address;
+    uint32_t data;
+    bool missed;             // Counted as a write miss already
+    uint32_t pc;             // The SW, for the profile
+} BufferedStore;
+
+typedef struct {
+    uint32_t pc;
+    uint32_t last_address;
+    int32_t stride;
+    int confidence;         // Times in a row the stride repeated
+} StrideEntry;
+
+// Per-core prefetch engine (config.prefetch only)
+typedef struct {
+    StrideEntry stride_table[STRIDE_TABLE_SIZE];
+    uint32_t queue[PREFETCH_QUEUE_SIZE]; // Block addresses, oldest first
+    int queue_head;
+    int queue_count;
+} Prefetcher;
+
+// Per-PC profile entry (config.profile only), one per imem word
+typedef struct {
+    int retired;             // Instructions that reached WB
+    int decode_stall;        // Cycles it waited in DECODE
+    int mem_stall;           // Cycles it held MEM waiting for the bus
+    int misses;              // Read / write misses of the LW / SW
+    int stall_caused;        // DECODE stall cycles of younger instructions waiting for its result
+    int producer;            // PC its DECODE stalls waited for most (majority vote), -1 if none
+    int producer_votes;
+} PcProfile;
+
 // Main core
 typedef struct {
     int id;                 
@@ -134,13 +302,55 @@ typedef struct {
     Cache cache;
     CoreStats stats;
     BusInterface bus_interface; // Private interface
-    uint32_t imem[IMEM_DEPTH]; 
+
+    // Non-blocking loads (config.mshrs only)
+    Mshr mshr[MAX_MSHRS];
+    uint16_t pending_loads;          // Scoreboard: registers an MSHR will write
+    uint16_t pending_fill_mask;      // Load data committed on the clock edge
+    int32_t pending_fill_value[REGISTER_COUNT];
+
+    // Store buffer (config.store_buffer only): FIFO of retired stores
+    BufferedStore store_buffer[MAX_STORE_BUFFER];
+    int sb_head;
+    int sb_count;
+    bool sb_issued;                  // The head store's request is the core's bus request
+
+    // Prefetching (config.prefetch only): BusRd requests of their own,
+    // granted only while no demand request is waiting (see bus.c)
+    BusInterface prefetch_interface;
+    Prefetcher prefetcher;
+    uint32_t * imem;      // imem_depth words
+    Instruction * program; // imem, predecoded
+    PcProfile * profile;   // imem_depth entries, config.profile only
+    PendingMiss missed[MAX_MISSES_PER_CYCLE]; // config.classify_misses only
+    int missed_count;
     bool halted;            
 } Core;
 
+// Interconnect counters of one core, see busstats.json (write_bus_stats())
+typedef struct {
+    long long wait_cycles;            // Cycles its demand request waited for the bus
+    long long grants[BUS_UPGR + 1];   // Transactions it put on the bus, by BusCmd (flushes included)
+    long long prefetches;             // Granted prefetch BusRd (not in grants)
+    long long eviction_flushes;       // Dirty victims it wrote back
+    long long snoop_flushes;          // MODIFIED blocks it flushed for another core's request
+    long long invalidations_sent;     // Copies its BusRdX / BusUpgr invalidated
+    long long invalidations_received; // Its copies invalidated by another core
+    long long exclusive_to_shared;    // Its EXCLUSIVE lines downgraded by a snooped BusRd
+} BusCoreStats;
+
+// What the bus did in a cycle: busy = address + cooldown + transfer
+typedef struct {
+    long long address_cycles;   // Arbitration granted a transaction
+    long long cooldown_cycles;  // Held by a transaction waiting out the memory latency
+    long long transfer_cycles;  // A data word moved
+    long long idle_cycles;
+} BusCycleStats;
+
 typedef struct {
-    Cache * cpu_cache[CORE_COUNT];
-    BusInterface * bus_interface[CORE_COUNT]; // Pointers to core interfaces
+    Cache ** cpu_cache;                // core_count entries
+    BusInterface ** bus_interface;     // Pointers to core interfaces
+    BusInterface ** prefetch_interface; // config.prefetch only
     uint32_t * system_memory; // Changed to uint32_t ptr
 
     // Current State of the Bus Wire
@@ -155,11 +365,40 @@ typedef struct {
     int word_offset;         
     int last_granted_device; 
     bool busy;               
+    BusTransaction active;   // The transaction holding the (atomic) bus
+
+    // Split-transaction bus (config.split_bus only)
+    BusTransaction * inflight;   // bus_inflight entries
+    int inflight_count;
+    int data_transfer;           // inflight entry in its data phase, -1 if none
+    long next_sequence;
+
+    // Snoop filter (config.snoop_filter only)
+    uint64_t * sharers;                 // Per memory block: bit c set while core c holds it valid
+    volatile uint64_t pending_requests; // Bit c set while core c has_pending_request
+    long long snoop_probes;             // Other-cache TSRAM lookups done when granting
+    long long snoop_probes_avoided;     // Lookups a full scan would have done on top
 
-    // For BUS_FLUSH completion: what MESI state should the flusher keep?
-    // - Eviction flush: INVALID
-    // - Snoop flush on BUS_RD: SHARED (M->S)
-    // - Snoop flush on BUS_RDX: INVALID (M->I)
-    MESI_State flush_post_state;
-    bool flush_post_state_valid;
-} SystemBus;
\ No newline at end of file
+    long long upgrades;      // Granted BUS_UPGR
+    long long rdx_requests;  // Granted BUS_RDX (including upgrades that lost their copy)
+
+    long long cache_transfers; // RD/RDX data supplied by another cache
+    long long memory_reads;    // RD/RDX data read from main memory
+    long long flushes;         // Blocks written back to main memory
+
+    // Miss classification (config.classify_misses only)
+    int cycle;                 // Current cycle (see sim_step()), stamps the miss history
+    uint32_t * word_written;   // Per memory word: cycle + 1 of the last store to it
+    uint32_t * block_classes;  // Per memory block: misses of every core, MISS_CLASS_COUNT counters
+
+    BusCycleStats cycle_stats;
+    BusCoreStats core_stats[MAX_CORE_COUNT];
+} SystemBus;
+
+// Machine state shared by every module of one simulation. Each Simulator owns
+// a context (see simulator.h) and the modules take it as their first argument,
+// so any number of simulations can run side by side.
+typedef struct {
+    SimConfig config;
+    SystemBus bus;
+} SimContext;
@@ -0,0 +1,340 @@
+#include "hex_io.h"
+#include "sim_thread.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// "00".."FF" for every byte value, so a word takes four table lookups
+static const char hex_pairs[] =
+    "000102030405060708090A0B0C0D0E0F"
+    "101112131415161718191A1B1C1D1E1F"
+    "202122232425262728292A2B2C2D2E2F"
+    "303132333435363738393A3B3C3D3E3F"
+    "404142434445464748494A4B4C4D4E4F"
+    "505152535455565758595A5B5C5D5E5F"
+    "606162636465666768696A6B6C6D6E6F"
+    "707172737475767778797A7B7C7D7E7F"
+    "808182838485868788898A8B8C8D8E8F"
+    "909192939495969798999A9B9C9D9E9F"
+    "A0A1A2A3A4A5A6A7A8A9AAABACADAEAF"
+    "B0B1B2B3B4B5B6B7B8B9BABBBCBDBEBF"
+    "C0C1C2C3C4C5C6C7C8C9CACBCCCDCECF"
+    "D0D1D2D3D4D5D6D7D8D9DADBDCDDDEDF"
+    "E0E1E2E3E4E5E6E7E8E9EAEBECEDEEEF"
+    "F0F1F2F3F4F5F6F7F8F9FAFBFCFDFEFF";
+
+void format_hex_words(const uint32_t* words, size_t count, char* out) {
+    for (size_t i = 0; i < count; i++) {
+        uint32_t w = words[i];
+        memcpy(out + 0, hex_pairs + 2 * ((w >> 24) & 0xFF), 2);
+        memcpy(out + 2, hex_pairs + 2 * ((w >> 16) & 0xFF), 2);
+        memcpy(out + 4, hex_pairs + 2 * ((w >> 8) & 0xFF), 2);
+        memcpy(out + 6, hex_pairs + 2 * (w & 0xFF), 2);
+        out[8] = '\n';
+        out += HEX_LINE_SIZE;
+    }
+}
+
+typedef struct {
+    const uint32_t* words;
+    size_t count;
+    char* out;
+} HexChunk;
+
+static void format_chunk(void* arg) {
+    HexChunk* chunk = (HexChunk*)arg;
+    format_hex_words(chunk->words, chunk->count, chunk->out);
+}
+
+bool write_hex_file(const char* path, const uint32_t* words, size_t count, int max_threads) {
+    FILE* file = fopen(path, "w");
+    if (!file) return false;
+
+    size_t size = count * HEX_LINE_SIZE;
+    char* buffer = (char*)malloc(size > 0 ? size : 1);
+    if (!buffer) {
+        fclose(file);
+        return false;
+    }
+
+    int threads = 1;
+    if (count >= HEX_PARALLEL_MIN_WORDS && max_threads > 1) {
+        threads = max_threads;
+        if (threads > HEX_MAX_THREADS) threads = HEX_MAX_THREADS;
+    }
+
+    // Chunk 0 is formatted on the calling thread, the rest on workers
+    HexChunk chunks[HEX_MAX_THREADS];
+    SimThread workers[HEX_MAX_THREADS];
+    bool started[HEX_MAX_THREADS] = { false };
+    size_t per_chunk = (count + threads - 1) / threads;
+    for (int t = 0; t < threads; t++) {
+        size_t first = (size_t)t * per_chunk;
+        size_t last = first + per_chunk < count ? first + per_chunk : count;
+        chunks[t].words = words + first;
+        chunks[t].count = first < last ? last - first : 0;
+        chunks[t].out = buffer + first * HEX_LINE_SIZE;
+        if (t > 0) started[t] = sim_thread_create(&workers[t], format_chunk, &chunks[t]);
+    }
+    format_chunk(&chunks[0]);
+    for (int t = 1; t < threads; t++) {
+        if (started[t]) sim_thread_join(workers[t]);
+        else format_chunk(&chunks[t]);
+    }
+
+    // One buffer, one write
+    setvbuf(file, NULL, _IONBF, 0);
+    bool ok = fwrite(buffer, 1, size, file) == size;
+    if (fclose(file) != 0) ok = false;
+    free(buffer);
+    return ok;
+}
+
+size_t hex_trimmed_length(const uint32_t* words, size_t count) {
+    while (count > 0 && words[count - 1] == 0) count--;
+    return count;
+}
+
+// Input side
+
+// Hex digit value + 1 of every byte, 0 for anything that is not a hex digit
+// (so the table can use designated initializers and leave the rest zero)
+static const uint8_t hex_digits[256] = {
+    ['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5,
+    ['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+    ['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+    ['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+};
+
+static bool is_space(char c) {
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\v' || c == '\f';
+}
+
+typedef struct {
+    const char* data;
+    size_t size;
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#endif
+    bool mapped;    // false -> data is a malloc'd copy (or NULL for an empty file)
+} MappedFile;
+
+#ifdef _WIN32
+
+static bool map_file(const char* path, MappedFile* mf) {
+    memset(mf, 0, sizeof(*mf));
+    mf->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (mf->file == INVALID_HANDLE_VALUE) return false;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(mf->file, &size)) {
+        CloseHandle(mf->file);
+        return false;
+    }
+    mf->size = (size_t)size.QuadPart;
+    if (mf->size == 0) return true;
+
+    mf->mapping = CreateFileMappingA(mf->file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mf->mapping != NULL) {
+        mf->data = (const char*)MapViewOfFile(mf->mapping, FILE_MAP_READ, 0, 0, 0);
+        mf->mapped = mf->data != NULL;
+    }
+    return mf->mapped;
+}
+
+static void unmap_file(MappedFile* mf) {
+    if (mf->mapped) UnmapViewOfFile(mf->data);
+    if (mf->mapping != NULL) CloseHandle(mf->mapping);
+    CloseHandle(mf->file);
+}
+
+#else
+
+static bool map_file(const char* path, MappedFile* mf) {
+    memset(mf, 0, sizeof(*mf));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return false;
+    }
+    mf->size = (size_t)st.st_size;
+    if (mf->size > 0) {
+        void* data = mmap(NULL, mf->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            mf->data = (const char*)data;
+            mf->mapped = true;
+        }
+    }
+    close(fd);
+
+    if (mf->size > 0 && !mf->mapped) {
+        // Not mappable (a pipe, for example): fall back to reading it
+        FILE* file = fopen(path, "rb");
+        char* copy = (char*)malloc(mf->size);
+        if (!file || !copy || fread(copy, 1, mf->size, file) != mf->size) {
+            if (file) fclose(file);
+            free(copy);
+            return false;
+        }
+        fclose(file);
+        mf->data = copy;
+    }
+    return true;
+}
+
+static void unmap_file(MappedFile* mf) {
+    if (mf->mapped) munmap((void*)mf->data, mf->size);
+    else free((void*)mf->data);
+}
+
+#endif
+
+// One word the way fscanf("%08x") reads it: an optional sign, then an
+// optional 0x / 0X prefix, then hex digits, 8 characters at most all together.
+// A negative word is negated (mod 2^32). Returns false if nothing was read.
+static bool parse_hex_token(const char** pp, const char* end, uint32_t* word) {
+    const char* p = *pp;
+    int width = 8;
+    bool negative = false;
+    if (p < end && (*p == '+' || *p == '-')) {
+        negative = *p == '-';
+        p++;
+        width--;
+    }
+    uint32_t value = 0;
+    int digits = 0;
+    if (width >= 2 && end - p >= 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) {
+        // The 0 counts as a digit, so a bare "0x" reads as 0
+        p += 2;
+        width -= 2;
+        digits = 1;
+    }
+    while (p < end && width > 0) {
+        int d = hex_digits[(uint8_t)*p];
+        if (d == 0) break;
+        value = (value << 4) | (uint32_t)(d - 1);
+        p++;
+        width--;
+        digits++;
+    }
+    *pp = p;
+    if (digits == 0) return false;
+    *word = negative ? 0u - value : value;
+    return true;
+}
+
+// Generic tokenizer with fscanf("%08x") semantics: skip whitespace, read words
+// with parse_hex_token(), stop at the first token that is not one (where the
+// fscanf() loops stopped making progress too).
+static size_t parse_hex_serial(const char* p, const char* end, uint32_t* words, size_t capacity) {
+    size_t count = 0;
+    while (count < capacity) {
+        while (p < end && is_space(*p)) p++;
+        if (p == end) break;
+        if (!parse_hex_token(&p, end, &words[count])) break; // Malformed token
+        count++;
+    }
+    return count;
+}
+
+typedef struct {
+    const char* data;
+    size_t stride;      // Bytes per line: 9 ("XXXXXXXX\n") or 10 ("XXXXXXXX\r\n")
+    size_t first;
+    size_t count;
+    uint32_t* words;
+    bool ok;
+} ParseChunk;
+
+// Fast path for images made only of canonical 8 digit lines. No branches on
+// the data: invalid characters are collected in a flag and the caller falls
+// back to parse_hex_serial() if any line was not canonical.
+static void parse_chunk(void* arg) {
+    ParseChunk* chunk = (ParseChunk*)arg;
+    const char* line = chunk->data + chunk->first * chunk->stride;
+    int invalid = 0;
+
+    for (size_t i = 0; i < chunk->count; i++) {
+        uint32_t value = 0;
+        for (int k = 0; k < 8; k++) {
+            int d = hex_digits[(uint8_t)line[k]] - 1;
+            invalid |= d;
+            value = (value << 4) | (uint32_t)(d & 0xF);
+        }
+        if (chunk->stride == 10) invalid |= -(line[8] != '\r');
+        invalid |= -(line[chunk->stride - 1] != '\n');
+        chunk->words[chunk->first + i] = value;
+        line += chunk->stride;
+    }
+    chunk->ok = invalid >= 0;
+}
+
+static size_t parse_hex_fixed(const char* data, size_t size, uint32_t* words, size_t capacity, int max_threads, bool* ok) {
+    *ok = false;
+    if (size < 9) return 0;
+
+    size_t stride = data[8] == '\r' ? 10 : 9;
+    size_t lines = size / stride;
+    if (lines > capacity) lines = capacity;
+
+    int threads = 1;
+    if (lines >= HEX_PARALLEL_MIN_WORDS && max_threads > 1) {
+        threads = max_threads;
+        if (threads > HEX_MAX_THREADS) threads = HEX_MAX_THREADS;
+    }
+
+    ParseChunk chunks[HEX_MAX_THREADS];
+    SimThread workers[HEX_MAX_THREADS];
+    bool started[HEX_MAX_THREADS] = { false };
+    size_t per_chunk = (lines + threads - 1) / threads;
+    for (int t = 0; t < threads; t++) {
+        size_t first = (size_t)t * per_chunk;
+        size_t last = first + per_chunk < lines ? first + per_chunk : lines;
+        chunks[t].data = data;
+        chunks[t].stride = stride;
+        chunks[t].first = first;
+        chunks[t].count = first < last ? last - first : 0;
+        chunks[t].words = words;
+        if (t > 0) started[t] = sim_thread_create(&workers[t], parse_chunk, &chunks[t]);
+    }
+    parse_chunk(&chunks[0]);
+    bool all_ok = chunks[0].ok;
+    for (int t = 1; t < threads; t++) {
+        if (started[t]) sim_thread_join(workers[t]);
+        else parse_chunk(&chunks[t]);
+        all_ok = all_ok && chunks[t].ok;
+    }
+    if (!all_ok) return 0;
+
+    // Whatever follows the last full line (an unterminated line, trailing blanks)
+    size_t tail = lines * stride;
+    *ok = true;
+    return lines + parse_hex_serial(data + tail, data + size, words + lines, capacity - lines);
+}
+
+long read_hex_file(const char* path, uint32_t* words, size_t capacity, int max_threads) {
+    MappedFile mf;
+    if (!map_file(path, &mf)) {
+        memset(words, 0, capacity * sizeof(uint32_t));
+        return -1;
+    }
+
+    bool ok = false;
+    size_t count = parse_hex_fixed(mf.data, mf.size, words, capacity, max_threads, &ok);
+    if (!ok) {
+        // Not a canonical image (or a malformed line somewhere): redo it the slow way
+        count = parse_hex_serial(mf.data, mf.data + mf.size, words, capacity);
+    }
+    memset(words + count, 0, (capacity - count) * sizeof(uint32_t));
+
+    unmap_file(&mf);
+    return (long)count;
+}
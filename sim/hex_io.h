@@ -0,0 +1,27 @@
+#pragma once
+#include "general_utils.h"
+
+// Fast hex word files ("%08X\n" per word) for the memory images.
+
+#define HEX_LINE_SIZE 9 // 8 hex digits + '\n'
+
+// Images at least this big are formatted by several threads
+#define HEX_PARALLEL_MIN_WORDS (1 << 16)
+#define HEX_MAX_THREADS 16
+
+// Format count words as "%08X\n" lines into out (count * HEX_LINE_SIZE bytes, no terminator)
+void format_hex_words(const uint32_t* words, size_t count, char* out);
+
+// Write words to path as a hex image using up to max_threads formatting threads.
+// Returns false if the file could not be written.
+bool write_hex_file(const char* path, const uint32_t* words, size_t count, int max_threads);
+
+// Number of words up to (and including) the last non-zero word
+size_t hex_trimmed_length(const uint32_t* words, size_t count);
+
+// Read a hex image ("%08x" words separated by whitespace) into words.
+// Words are read like fscanf("%08x"): an optional sign and 0x prefix, then hex
+// digits, 8 characters at most. Parsing stops at the first malformed token,
+// like fscanf() did, and every word that was not read is zero. Returns the
+// number of words read, or -1 if the file could not be opened.
+long read_hex_file(const char* path, uint32_t* words, size_t capacity, int max_threads);
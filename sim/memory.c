@@ -1,50 +1,329 @@
 #include "memory.h"
 #include "bus.h"
+#include "miss_class.h"
 
-bool is_cache_hit(Cache * cache, int address){
-    uint32_t index = (address >> 3) & 0x3F; // 6 bits
-    uint32_t tag = (address >> 9) & 0xFFF; 
-    
-    if (cache->tsram[index].mesi_state != MESI_INVALID && cache->tsram[index].tag == tag) {
-        return true;
+bool init_cache(SimContext * ctx, Cache * cache, int core_id){
+    memset(cache, 0, sizeof(*cache));
+    cache->dsram = (uint32_t*)calloc((size_t)ctx->config.dsram_depth, sizeof(uint32_t));
+    cache->tsram = (TSRAM_Line*)calloc((size_t)ctx->config.tsram_depth, sizeof(TSRAM_Line));
+    if (cache->dsram == NULL || cache->tsram == NULL) return false;
+
+    if (ctx->config.cache_ways > 1) {
+        if (ctx->config.replacement == REPLACE_LRU) {
+            cache->last_use = (uint32_t*)calloc((size_t)ctx->config.tsram_depth, sizeof(uint32_t));
+            if (cache->last_use == NULL) return false;
+        } else if (ctx->config.replacement == REPLACE_PLRU) {
+            cache->plru_bits = (uint64_t*)calloc((size_t)ctx->config.cache_sets, sizeof(uint64_t));
+            if (cache->plru_bits == NULL) return false;
+        }
+    }
+    cache->random_state = 2463534242u + (uint32_t)core_id; // Any non-zero seed
+
+    if (ctx->config.prefetch != PREFETCH_NONE) {
+        cache->prefetched = (uint8_t*)calloc((size_t)ctx->config.tsram_depth, sizeof(uint8_t));
+        if (cache->prefetched == NULL) return false;
+    }
+
+    if (ctx->config.classify_misses && !init_miss_tables(ctx, cache)) return false;
+    return true;
+}
+
+void free_cache(Cache * cache){
+    free(cache->dsram);
+    free(cache->tsram);
+    free(cache->last_use);
+    free(cache->plru_bits);
+    free(cache->prefetched);
+    free_miss_tables(cache);
+    cache->dsram = NULL;
+    cache->tsram = NULL;
+    cache->last_use = NULL;
+    cache->plru_bits = NULL;
+    cache->prefetched = NULL;
+}
+
+int find_cache_line(SimContext * ctx, const Cache * cache, uint32_t address){
+    uint32_t set = CACHE_INDEX(ctx, address);
+    uint32_t tag = CACHE_TAG(ctx, address);
+
+    for (int way = 0; way < ctx->config.cache_ways; way++) {
+        const TSRAM_Line* t_line = &cache->tsram[CACHE_LINE(ctx, set, way)];
+        if (t_line->mesi_state != MESI_INVALID && t_line->tag == tag) {
+            return (int)CACHE_LINE(ctx, set, way);
+        }
+    }
+    return -1;
+}
+
+// PLRU tree of a set: node 1 is the root, node n has children 2n and 2n + 1,
+// the leaves are the ways. A node bit set means "the victim is on the right".
+static int plru_victim(SimContext* ctx, uint64_t bits){
+    int node = 1;
+    int way = 0;
+    for (int half = ctx->config.cache_ways / 2; half >= 1; half /= 2) {
+        int right = (int)((bits >> node) & 1);
+        if (right) way |= half;
+        node = 2 * node + right;
+    }
+    return way;
+}
+
+static void plru_touch(SimContext* ctx, uint64_t* bits, int way){
+    int node = 1;
+    for (int half = ctx->config.cache_ways / 2; half >= 1; half /= 2) {
+        int right = (way & half) != 0;
+        // Point the node away from the way just used
+        if (right) *bits &= ~(1ULL << node);
+        else *bits |= 1ULL << node;
+        node = 2 * node + right;
+    }
+}
+
+static int replacement_victim(SimContext * ctx, Cache * cache, uint32_t set){
+    switch (ctx->config.replacement) {
+        case REPLACE_PLRU:
+            return plru_victim(ctx, cache->plru_bits[set]);
+        case REPLACE_RANDOM: {
+            // xorshift32
+            uint32_t x = cache->random_state;
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+            cache->random_state = x;
+            return (int)(x & (uint32_t)(ctx->config.cache_ways - 1));
+        }
+        case REPLACE_LRU:
+        default: {
+            int victim = 0;
+            for (int way = 1; way < ctx->config.cache_ways; way++) {
+                if (cache->last_use[CACHE_LINE(ctx, set, way)] < cache->last_use[CACHE_LINE(ctx, set, victim)]) victim = way;
+            }
+            return victim;
+        }
+    }
+}
+
+int choose_fill_line(SimContext * ctx, Cache * cache, uint32_t address){
+    int line = find_cache_line(ctx, cache, address);
+    if (line >= 0) return line;
+
+    // Direct-mapped: no replacement state to choose by (see init_cache())
+    uint32_t set = CACHE_INDEX(ctx, address);
+    if (ctx->config.cache_ways == 1) return (int)CACHE_LINE(ctx, set, 0);
+    for (int way = 0; way < ctx->config.cache_ways; way++) {
+        if (cache->tsram[CACHE_LINE(ctx, set, way)].mesi_state == MESI_INVALID) return (int)CACHE_LINE(ctx, set, way);
+    }
+    return (int)CACHE_LINE(ctx, set, replacement_victim(ctx, cache, set));
+}
+
+void touch_cache_line(SimContext * ctx, Cache * cache, int line){
+    if (ctx->config.cache_ways == 1) return; // Direct-mapped: nothing to choose from
+
+    if (ctx->config.replacement == REPLACE_LRU) {
+        cache->last_use[line] = ++cache->use_clock;
+    } else if (ctx->config.replacement == REPLACE_PLRU) {
+        plru_touch(ctx, &cache->plru_bits[LINE_SET(ctx, line)], line / ctx->config.cache_sets);
     }
-    return false;
 }
 
-uint32_t read_word_from_cache(Cache * cache, int address){
-    uint32_t index = (address >> 3) & 0x3F; 
-    uint32_t offset = address & 0x7; 
-    return cache->dsram[index].word[offset];
+// First demand access to a prefetched line
+static void note_demand_use(Cache * cache, int line){
+    if (cache->prefetched && cache->prefetched[line]) {
+        cache->prefetched[line] = 0;
+        cache->prefetch_useful++;
+    }
 }
 
-bool write_word_to_cache(Core * core, int address, uint32_t data){
-    uint32_t index = (address >> 3) & 0x3F;
-    uint32_t offset = address & 0x7;
-    uint32_t tag = (address >> 9) & 0xFFF;
-    
-    TSRAM_Line* t_line = &core->cache.tsram[index];
-    DSRAM_Line* d_line = &core->cache.dsram[index];
+bool is_cache_hit(SimContext * ctx, Cache * cache, int address){
+    return find_cache_line(ctx, cache, (uint32_t)address) >= 0;
+}
+
+uint32_t read_word_from_cache(SimContext * ctx, Cache * cache, int address){
+    int line = find_cache_line(ctx, cache, (uint32_t)address);
+    if (line < 0) return 0; // Callers check is_cache_hit() first
+    touch_cache_line(ctx, cache, line);
+    note_demand_use(cache, line);
+    return CACHE_WORD(ctx, cache, line, CACHE_OFFSET(ctx, address));
+}
 
-    // Check Tag match first
-    if (t_line->tag != tag || t_line->mesi_state == MESI_INVALID) {
+bool write_word_to_cache(SimContext * ctx, Core * core, int address, uint32_t data){
+    int line = find_cache_line(ctx, &core->cache, (uint32_t)address);
+
+    // Check Tag match first (in every way of the set)
+    if (line < 0) {
         // Miss (Read for Ownership needed)
-        send_bus_read_request(core, address, true);
+        send_bus_read_request(ctx, core, address, true);
         return false; 
     }
 
     // It's a Hit, check State
+    TSRAM_Line* t_line = &core->cache.tsram[line];
     switch (t_line->mesi_state){
         case MESI_MODIFIED:
         case MESI_EXCLUSIVE:
-            d_line->word[offset] = data;
+            touch_cache_line(ctx, &core->cache, line);
+            note_demand_use(&core->cache, line);
+            CACHE_WORD(ctx, &core->cache, line, CACHE_OFFSET(ctx, address)) = data;
             t_line->mesi_state = MESI_MODIFIED;
+            if (ctx->config.classify_misses) note_store(ctx, (uint32_t)address);
             return true;
         case MESI_SHARED:
+        case MESI_OWNED:
+        case MESI_FORWARD:
             // Need to upgrade to Exclusive (Bus Upgrade/Invalidate others)
-            // For simplicity, we send a RDX.
-            send_bus_read_request(core, address, true);
+            // Without bus_upgrade, for simplicity, we send a RDX.
+            if (ctx->config.bus_upgrade) send_bus_upgrade_request(ctx, core, address);
+            else send_bus_read_request(ctx, core, address, true);
             return false; // STALL until bus done
         default:
             return false;
     }
-}
\ No newline at end of file
+}
+
+bool mshr_allocate(SimContext * ctx, Core * core, uint32_t address, uint8_t reg){
+    uint32_t block = address & ~(uint32_t)(ctx->config.block_size - 1);
+    Mshr* mshr = NULL;
+    for (int i = 0; i < ctx->config.mshrs && !mshr; i++) {
+        Mshr* m = &core->mshr[i];
+        if (m->valid && (m->address & ~(uint32_t)(ctx->config.block_size - 1)) == block) mshr = m;
+    }
+    for (int i = 0; i < ctx->config.mshrs && !mshr; i++) {
+        Mshr* m = &core->mshr[i];
+        if (!m->valid) {
+            memset(m, 0, sizeof(*m));
+            m->valid = true;
+            m->address = address;
+            mshr = m;
+        }
+    }
+    if (!mshr) return false;
+
+    // R0 / R1 are never written, the load only brings the block in
+    if (reg > 1) {
+        mshr->targets |= (uint16_t)(1 << reg);
+        mshr->target_offset[reg] = (uint8_t)CACHE_OFFSET(ctx, address);
+        core->pending_loads |= (uint16_t)(1 << reg);
+    }
+    return true;
+}
+
+void mshr_step(SimContext * ctx, Core * core){
+    BusInterface* bi = &core->bus_interface;
+    Mshr* on_bus = NULL;
+    for (int i = 0; i < ctx->config.mshrs; i++) {
+        if (core->mshr[i].valid && core->mshr[i].issued) on_bus = &core->mshr[i];
+    }
+
+    if (on_bus && bi->request_done) {
+        bi->request_done = false;
+        on_bus->issued = false;
+        // The line can be lost to a snoop before we get here, then ask again
+        if (is_cache_hit(ctx, &core->cache, (int)on_bus->address)) {
+            uint32_t block = on_bus->address & ~(uint32_t)(ctx->config.block_size - 1);
+            for (int reg = 2; reg < REGISTER_COUNT; reg++) {
+                if (!(on_bus->targets & (1 << reg))) continue;
+                core->pending_fill_value[reg] =
+                    (int32_t)read_word_from_cache(ctx, &core->cache, (int)(block + on_bus->target_offset[reg]));
+            }
+            core->pending_fill_mask |= on_bus->targets;
+            on_bus->valid = false;
+        }
+        on_bus = NULL;
+    }
+
+    // One request at a time: a stalled store that got the interface first
+    // (or has its data back, but did not retry yet) goes before the next MSHR
+    if (!on_bus && !bi->has_pending_request && !bi->request_done) {
+        for (int i = 0; i < ctx->config.mshrs; i++) {
+            Mshr* m = &core->mshr[i];
+            if (m->valid) {
+                send_bus_read_request(ctx, core, m->address, false);
+                m->issued = true;
+                break;
+            }
+        }
+    }
+}
+
+int mshr_in_use(SimContext * ctx, const Core * core){
+    int count = 0;
+    for (int i = 0; i < ctx->config.mshrs; i++) {
+        if (core->mshr[i].valid) count++;
+    }
+    return count;
+}
+
+bool store_buffer_push(SimContext * ctx, Core * core, uint32_t address, uint32_t data){
+    if (core->sb_count == 0) {
+        int line = find_cache_line(ctx, &core->cache, address);
+        MESI_State state = line >= 0 ? core->cache.tsram[line].mesi_state : MESI_INVALID;
+        if (state == MESI_MODIFIED || state == MESI_EXCLUSIVE) {
+            write_word_to_cache(ctx, core, (int)address, data);
+            core->stats.write_hits++;
+            return true;
+        }
+    }
+    if (core->sb_count == ctx->config.store_buffer) return false;
+
+    BufferedStore* entry = &core->store_buffer[(core->sb_head + core->sb_count) % ctx->config.store_buffer];
+    entry->address = address;
+    entry->data = data;
+    entry->missed = false;
+    entry->pc = core->pipe.mem.pc; // Pushed by the SW in MEM
+    core->sb_count++;
+    core->stats.sb_stores++;
+    return true;
+}
+
+bool store_buffer_forward(SimContext * ctx, const Core * core, uint32_t address, uint32_t * data){
+    for (int i = core->sb_count - 1; i >= 0; i--) {
+        const BufferedStore* entry = &core->store_buffer[(core->sb_head + i) % ctx->config.store_buffer];
+        if (entry->address == address) {
+            *data = entry->data;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool store_buffer_conflicts(SimContext * ctx, const Core * core, uint32_t address){
+    uint32_t block = address >> ctx->config.offset_bits;
+    for (int i = 0; i < core->sb_count; i++) {
+        const BufferedStore* entry = &core->store_buffer[(core->sb_head + i) % ctx->config.store_buffer];
+        if (CACHE_INDEX(ctx, entry->address) == CACHE_INDEX(ctx, address) && (entry->address >> ctx->config.offset_bits) != block) return true;
+    }
+    return false;
+}
+
+void store_buffer_step(SimContext * ctx, Core * core){
+    BusInterface* bi = &core->bus_interface;
+    if (core->sb_count == 0) return;
+
+    // Retry the head store when its request is back, or once the interface is
+    // free. A hit needs no interface at all.
+    if (core->sb_issued) {
+        if (!bi->request_done) return;
+        bi->request_done = false;
+        core->sb_issued = false;
+    }
+
+    BufferedStore* head = &core->store_buffer[core->sb_head];
+    int line = find_cache_line(ctx, &core->cache, head->address);
+    MESI_State state = line >= 0 ? core->cache.tsram[line].mesi_state : MESI_INVALID;
+    bool writable = state == MESI_MODIFIED || state == MESI_EXCLUSIVE;
+    if (!writable && (bi->has_pending_request || bi->request_done)) return;
+
+    if (write_word_to_cache(ctx, core, (int)head->address, head->data)) {
+        if (!head->missed) core->stats.write_hits++;
+        core->sb_head = (core->sb_head + 1) % ctx->config.store_buffer;
+        core->sb_count--;
+    } else {
+        if (!head->missed) {
+            core->stats.write_misses++;
+            if (core->profile) core->profile[head->pc].misses++;
+            if (ctx->config.classify_misses) note_miss(ctx, core, head->address);
+        }
+        head->missed = true;
+        core->sb_issued = true;
+    }
+}
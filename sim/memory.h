@@ -1,5 +1,49 @@
+#pragma once
 #include "general_utils.h"
 
-bool is_cache_hit(Cache* cache, int address);
-uint32_t read_word_from_cache(Cache* cache, int address);
-bool write_word_to_cache(Core * core, int address, uint32_t data);
+// Address split for the configured geometry (word addresses, see SimConfig)
+#define CACHE_OFFSET(ctx, address) ((uint32_t)(address) & (uint32_t)((ctx)->config.block_size - 1))
+#define CACHE_INDEX(ctx, address) (((uint32_t)(address) >> (ctx)->config.offset_bits) & (uint32_t)((ctx)->config.cache_sets - 1))
+#define CACHE_TAG(ctx, address) (((uint32_t)(address) >> ((ctx)->config.offset_bits + (ctx)->config.index_bits)) & ((1u << (ctx)->config.tag_bits) - 1))
+#define BLOCK_ADDRESS(ctx, tag, index) (((uint32_t)(tag) << ((ctx)->config.offset_bits + (ctx)->config.index_bits)) | ((uint32_t)(index) << (ctx)->config.offset_bits))
+
+// Lines: way after way, so set and way of a line are line % sets and line / sets
+#define CACHE_LINE(ctx, set, way) ((uint32_t)(way) * (uint32_t)(ctx)->config.cache_sets + (uint32_t)(set))
+#define LINE_SET(ctx, line) ((uint32_t)(line) & (uint32_t)((ctx)->config.cache_sets - 1))
+#define CACHE_WORD(ctx, cache, line, offset) ((cache)->dsram[(size_t)(line) * (ctx)->config.block_size + (offset)])
+
+bool init_cache(SimContext* ctx, Cache* cache, int core_id);
+void free_cache(Cache* cache);
+
+// Line holding address in a valid state, -1 on a miss
+int find_cache_line(SimContext* ctx, const Cache* cache, uint32_t address);
+// Line a fill of address goes to: the line already holding it, else an
+// invalid way of the set, else the replacement policy's victim
+int choose_fill_line(SimContext* ctx, Cache* cache, uint32_t address);
+// Record an access for the replacement policy
+void touch_cache_line(SimContext* ctx, Cache* cache, int line);
+
+bool is_cache_hit(SimContext* ctx, Cache* cache, int address);
+uint32_t read_word_from_cache(SimContext* ctx, Cache* cache, int address);
+bool write_word_to_cache(SimContext * ctx, Core * core, int address, uint32_t data);
+
+// Non-blocking loads (config.mshrs): a LW miss to register reg is handed
+// to an MSHR, merged with a pending miss to the same block if there is one.
+// Returns false if every MSHR is busy with another block.
+bool mshr_allocate(SimContext * ctx, Core * core, uint32_t address, uint8_t reg);
+// Once per cycle before MEM: deliver a finished fill, post the next BUS_RD
+void mshr_step(SimContext * ctx, Core * core);
+int mshr_in_use(SimContext * ctx, const Core * core);
+
+// Store buffer (config.store_buffer): stores retire in MEM and reach the
+// cache in program order. With the buffer empty and the line writable the
+// store is done right away. Returns false if the buffer is full.
+bool store_buffer_push(SimContext * ctx, Core * core, uint32_t address, uint32_t data);
+// Data of the youngest buffered store to address, for a LW
+bool store_buffer_forward(SimContext * ctx, const Core * core, uint32_t address, uint32_t * data);
+// True if a fill of address could evict the block of a buffered store (same
+// set, other block). A LW miss waits for those stores: the store would bring
+// its block back afterwards, where a later eviction no longer writes it back.
+bool store_buffer_conflicts(SimContext * ctx, const Core * core, uint32_t address);
+// Once per cycle before MEM: write the oldest store, or ask for its line
+void store_buffer_step(SimContext * ctx, Core * core);
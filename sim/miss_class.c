@@ -0,0 +1,125 @@
+#include "miss_class.h"
+
+#define WORD_NUMBER(address) ((uint32_t)(address) & (MEMIN_DEPTH - 1))
+#define BLOCK_OF(ctx, address) (WORD_NUMBER(address) >> (ctx)->config.offset_bits)
+
+static size_t block_count(SimContext* ctx) {
+    return (size_t)(MEMIN_DEPTH >> ctx->config.offset_bits);
+}
+
+bool init_miss_tables(SimContext* ctx, Cache* cache) {
+    cache->block_history = (uint32_t*)calloc(block_count(ctx), sizeof(uint32_t));
+    cache->block_misses = (uint32_t*)calloc(block_count(ctx), sizeof(uint32_t));
+    return cache->block_history && cache->block_misses;
+}
+
+void free_miss_tables(Cache* cache) {
+    free(cache->block_history);
+    free(cache->block_misses);
+    free(cache->sharing_misses);
+    cache->block_history = NULL;
+    cache->block_misses = NULL;
+    cache->sharing_misses = NULL;
+    cache->sharing_miss_count = 0;
+    cache->sharing_miss_capacity = 0;
+}
+
+bool init_bus_miss_tables(SimContext* ctx) {
+    ctx->bus.word_written = (uint32_t*)calloc(MEMIN_DEPTH, sizeof(uint32_t));
+    ctx->bus.block_classes = (uint32_t*)calloc(block_count(ctx) * MISS_CLASS_COUNT, sizeof(uint32_t));
+    return ctx->bus.word_written && ctx->bus.block_classes;
+}
+
+void free_bus_miss_tables(SimContext* ctx) {
+    free(ctx->bus.word_written);
+    free(ctx->bus.block_classes);
+    ctx->bus.word_written = NULL;
+    ctx->bus.block_classes = NULL;
+}
+
+static void count_miss(SimContext* ctx, Cache* cache, uint32_t address, MissClass miss_class) {
+    uint32_t block = address >> ctx->config.offset_bits;
+    cache->misses_by_class[miss_class]++;
+    cache->block_misses[block]++;
+    ctx->bus.block_classes[(size_t)block * MISS_CLASS_COUNT + miss_class]++;
+}
+
+// Stores of the invalidation cycle ran before the bus, so they came first
+static void count_sharing_miss(SimContext* ctx, Cache* cache, const PendingMiss* miss) {
+    bool written = ctx->bus.word_written[miss->address] > miss->invalidated_at + 1;
+    count_miss(ctx, cache, miss->address, written ? MISS_TRUE_SHARING : MISS_FALSE_SHARING);
+}
+
+void note_block_cached(SimContext* ctx, Cache* cache, uint32_t block) {
+    cache->block_history[block] = BLOCK_CACHED;
+
+    // The data is in, a store from here on would invalidate this copy again
+    int kept = 0;
+    for (int i = 0; i < cache->sharing_miss_count; i++) {
+        const PendingMiss* miss = &cache->sharing_misses[i];
+        if ((miss->address >> ctx->config.offset_bits) == block) count_sharing_miss(ctx, cache, miss);
+        else cache->sharing_misses[kept++] = *miss;
+    }
+    cache->sharing_miss_count = kept;
+}
+
+void note_block_left(Cache* cache, uint32_t block) {
+    cache->block_history[block] = BLOCK_EVICTED;
+}
+
+void note_block_invalidated(SimContext* ctx, Cache* cache, uint32_t block) {
+    cache->block_history[block] = BLOCK_INVALIDATED + (uint32_t)ctx->bus.cycle;
+}
+
+void note_miss(SimContext* ctx, Core* core, uint32_t address) {
+    if (core->missed_count == MAX_MISSES_PER_CYCLE) return;
+    PendingMiss* miss = &core->missed[core->missed_count++];
+    uint32_t history = core->cache.block_history[BLOCK_OF(ctx, address)];
+    miss->address = WORD_NUMBER(address);
+    miss->invalidated_at = 0;
+    switch (history) {
+        case BLOCK_NEVER_CACHED: miss->miss_class = MISS_COMPULSORY; break;
+        case BLOCK_CACHED: miss->miss_class = MISS_UPGRADE; break;
+        case BLOCK_EVICTED: miss->miss_class = MISS_CONFLICT; break;
+        default:
+            miss->miss_class = MISS_TRUE_SHARING;
+            miss->invalidated_at = history - BLOCK_INVALIDATED;
+            break;
+    }
+}
+
+void note_store(SimContext* ctx, uint32_t address) {
+    ctx->bus.word_written[WORD_NUMBER(address)] = (uint32_t)ctx->bus.cycle + 1;
+}
+
+void count_misses(SimContext* ctx, Core* core) {
+    Cache* cache = &core->cache;
+    for (int i = 0; i < core->missed_count; i++) {
+        const PendingMiss* miss = &core->missed[i];
+        if (miss->miss_class != MISS_TRUE_SHARING) {
+            count_miss(ctx, cache, miss->address, miss->miss_class);
+            continue;
+        }
+        if (cache->block_history[miss->address >> ctx->config.offset_bits] == BLOCK_CACHED) {
+            count_sharing_miss(ctx, cache, miss); // A prefetch brought the block back this cycle
+            continue;
+        }
+        if (cache->sharing_miss_count == cache->sharing_miss_capacity) {
+            int capacity = cache->sharing_miss_capacity ? 2 * cache->sharing_miss_capacity : 8;
+            PendingMiss* misses = (PendingMiss*)realloc(cache->sharing_misses, (size_t)capacity * sizeof(PendingMiss));
+            if (!misses) {
+                count_sharing_miss(ctx, cache, miss); // Decided now rather than lost
+                continue;
+            }
+            cache->sharing_misses = misses;
+            cache->sharing_miss_capacity = capacity;
+        }
+        cache->sharing_misses[cache->sharing_miss_count++] = *miss;
+    }
+    core->missed_count = 0;
+}
+
+void finish_sharing_misses(SimContext* ctx, Cache* cache) {
+    for (int i = 0; i < cache->sharing_miss_count; i++) count_sharing_miss(ctx, cache, &cache->sharing_misses[i]);
+    cache->sharing_miss_count = 0;
+}
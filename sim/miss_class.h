@@ -0,0 +1,45 @@
+#pragma once
+#include "general_utils.h"
+
+// Miss classification (config.classify_misses): every read / write miss
+// of the stats gets a MissClass from the history of its block in the missing
+// cache (Cache.block_history):
+//   BLOCK_NEVER_CACHED     compulsory
+//   BLOCK_CACHED           the copy is still valid, a write to a shared copy: upgrade
+//   BLOCK_EVICTED          replaced by a fill of the same cache: conflict
+//   BLOCK_INVALIDATED + c  invalidated by another core's BusRdX / BusUpgr in
+//                          cycle c: a coherence miss
+// The bus keeps the history, stores stamp bus.word_written. Misses are
+// noted in MEM / the store buffer and counted on the clock edge, so a run on
+// worker threads counts the same. A coherence miss waits in
+// Cache.sharing_misses until its block is back in the cache, the writers are
+// done with it then: true sharing if a store wrote the missing word after
+// cycle c, false sharing if the invalidation only brought other words.
+// write_miss_report() (file_io.c) writes the totals and the worst blocks.
+
+#define BLOCK_NEVER_CACHED 0
+#define BLOCK_CACHED 1
+#define BLOCK_EVICTED 2
+#define BLOCK_INVALIDATED 3
+
+// The per-block tables of a cache and of the bus
+bool init_miss_tables(SimContext* ctx, Cache* cache);
+void free_miss_tables(Cache* cache);
+bool init_bus_miss_tables(SimContext* ctx);
+void free_bus_miss_tables(SimContext* ctx);
+
+// Bus side: a block became valid in cache, left it (replaced or invalidated),
+// or another core's write invalidated it
+void note_block_cached(SimContext* ctx, Cache* cache, uint32_t block);
+void note_block_left(Cache* cache, uint32_t block);
+void note_block_invalidated(SimContext* ctx, Cache* cache, uint32_t block);
+
+// Core side: a read / write miss of address, a store that wrote address
+void note_miss(SimContext* ctx, Core* core, uint32_t address);
+void note_store(SimContext* ctx, uint32_t address);
+
+// Clock edge: count the misses core noted this cycle
+void count_misses(SimContext* ctx, Core* core);
+
+// End of the run: count the coherence misses whose block never came back
+void finish_sharing_misses(SimContext* ctx, Cache* cache);
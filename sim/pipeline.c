@@ -1,6 +1,8 @@
 #include "pipeline.h"
 #include "memory.h"
 #include "bus.h"
+#include "prefetch.h"
+#include "miss_class.h"
 
 // Helper: Does this opcode WRITE to register RD?
 static bool opcode_writes_rd(Opcode op) {
@@ -14,21 +16,6 @@ static bool opcode_writes_rd(Opcode op) {
     }
 }
 
-// For hazard detection we need to know the actual destination register.
-// JAL writes to R15 (link), while arithmetic/lw write to RD.
-static bool stage_writes_reg(const PipelineStage* st, uint8_t* out_dst) {
-    if (!st || !st->active) return false;
-    if (st->inst.opcode == OP_JAL) {
-        *out_dst = 15;
-        return true;
-    }
-    if (opcode_writes_rd(st->inst.opcode)) {
-        *out_dst = st->inst.rd;
-        return true;
-    }
-    return false;
-}
-
 // Helper: Does this opcode READ from register RS?
 static bool opcode_reads_rs(Opcode op) {
     // Almost all ops use RS as a source (Arithmetic, Branch, Load, Store)
@@ -67,13 +54,124 @@ static bool opcode_reads_rd(Opcode op) {
     }
 }
 
-void execute_stage(Core * core){
+// Decode every imem word once, so DECODE and the hazard check only look up
+// precomputed fields and masks.
+static void predecode_instruction(uint32_t binary_raw, Instruction* inst) {
+    inst->binary_value = binary_raw;
+    inst->opcode = (Opcode)((binary_raw >> 24) & 0xFF);
+    inst->rd = (uint8_t)((binary_raw >> 20) & 0xF);
+    inst->rs = (uint8_t)((binary_raw >> 16) & 0xF);
+    inst->rt = (uint8_t)((binary_raw >> 12) & 0xF);
+    
+    int32_t imm12 = binary_raw & 0xFFF;
+    if (imm12 & 0x800) imm12 |= 0xFFFFF000;
+    inst->imm = imm12;
+
+    // R0 is hard-wired to 0 and R1 is immediate-only, neither can be a hazard
+    const uint16_t hazard_regs = 0xFFFC;
+
+    inst->src_mask = 0;
+    if (opcode_reads_rs(inst->opcode)) inst->src_mask |= (uint16_t)(1 << inst->rs);
+    if (opcode_reads_rt(inst->opcode)) inst->src_mask |= (uint16_t)(1 << inst->rt);
+    if (opcode_reads_rd(inst->opcode)) inst->src_mask |= (uint16_t)(1 << inst->rd);
+    inst->src_mask &= hazard_regs;
+
+    // JAL writes to R15 (link), while arithmetic/lw write to RD.
+    inst->writes_dst = false;
+    inst->dst = 0;
+    if (inst->opcode == OP_JAL) {
+        inst->writes_dst = true;
+        inst->dst = 15;
+    } else if (opcode_writes_rd(inst->opcode)) {
+        inst->writes_dst = true;
+        inst->dst = inst->rd;
+    }
+    inst->dst_mask = inst->writes_dst ? (uint16_t)((1 << inst->dst) & hazard_regs) : 0;
+}
+
+void predecode_imem(SimContext * ctx, Core * core){
+    for (int pc = 0; pc < ctx->config.imem_depth; pc++) {
+        predecode_instruction(core->imem[pc], &core->program[pc]);
+    }
+}
+
+// Registers written back by an instruction in this stage (hazard mask).
+// A LW waiting in an MSHR is tracked by the scoreboard instead.
+static uint16_t stage_dst_mask(const PipelineStage* st) {
+    return (st->active && !st->load_pending) ? st->inst->dst_mask : 0;
+}
+
+// Forwarding: the value of reg for the instruction in DECODE, from the youngest
+// instruction ahead that writes it. EXEC and MEM already ran this cycle, so
+// their results are final. Seen from the EXEC stage of the next cycle these are
+// the MEM->EX, WB->EX and WB->DECODE (register file) paths. Returns false
+// when the value is not there in time: a load still in EXEC (load-use), or a
+// branch operand that DECODE itself needs from EXEC or from a load in MEM.
+static bool forward_operand(const Core* core, uint8_t reg, bool used_in_decode, int32_t* value) {
+    uint16_t bit = (uint16_t)(1 << reg);
+    const PipelineStage* ex = &core->pipe.execute;
+    const PipelineStage* mem = &core->pipe.mem;
+
+    if (stage_dst_mask(ex) & bit) {
+        if (used_in_decode || ex->inst->opcode == OP_LW) return false;
+        *value = ex->result;
+    } else if (stage_dst_mask(mem) & bit) {
+        if (used_in_decode && mem->inst->opcode == OP_LW) return false;
+        *value = mem->result;
+    } else if (stage_dst_mask(&core->pipe.wb) & bit) {
+        *value = core->pipe.wb.result;
+    }
+    return true;
+}
+
+// Profile: a DECODE stall cycle of the instruction at pc, waiting for the
+// youngest instruction ahead that writes one of its sources (none for the
+// MSHR scoreboard and HALT draining). The producer kept per PC is a majority
+// vote, so a stall site with one dominant producer reports that one.
+static void profile_decode_stall(Core* core, const Instruction* inst) {
+    const PipelineStage* ahead[] = { &core->pipe.execute, &core->pipe.mem, &core->pipe.wb };
+    int producer = -1;
+    for (int s = 0; s < 3; s++) {
+        if (stage_dst_mask(ahead[s]) & inst->src_mask) {
+            producer = (int)ahead[s]->pc;
+            break;
+        }
+    }
+
+    PcProfile* p = &core->profile[core->pipe.decode.pc];
+    p->decode_stall++;
+    if (p->producer == producer) {
+        p->producer_votes++;
+    } else if (p->producer_votes == 0) {
+        p->producer = producer;
+        p->producer_votes = 1;
+    } else {
+        p->producer_votes--;
+    }
+    if (producer >= 0) core->profile[producer].stall_caused++;
+}
+
+void profile_repeat_cycle(Core* core, const CoreStats* delta, int count) {
+    PcProfile* profile = core->profile;
+    profile[core->pipe.wb.pc].retired += delta->instructions * count;
+    profile[core->pipe.mem.pc].mem_stall += delta->mem_stall * count;
+    profile[core->pipe.mem.pc].misses += (delta->read_misses + delta->write_misses) * count;
+    for (int i = 0; i < delta->decode_stall * count; i++) {
+        profile_decode_stall(core, core->pipe.decode.inst);
+    }
+}
+
+static bool stage_is_memory_op(const PipelineStage* st) {
+    return st->active && (st->inst->opcode == OP_LW || st->inst->opcode == OP_SW);
+}
+
+void execute_stage(SimContext * ctx, Core * core){
     if (core == NULL) return;
     if (core->pipe.execute.active == 0) return;
 
-    Instruction *inst = &core->pipe.execute.inst;
-     int32_t rs_val = (inst->rs != 1) ? core->regs[inst->rs] : inst->imm;
-    int32_t rt_val = (inst->rt != 1) ? core->regs[inst->rt] : inst->imm;
+    const Instruction *inst = core->pipe.execute.inst;
+    int32_t rs_val = core->pipe.execute.rs_val;
+    int32_t rt_val = core->pipe.execute.rt_val;
     int32_t results = 0;
 
     switch (inst->opcode) {
@@ -88,7 +186,7 @@ void execute_stage(Core * core){
         case OP_SRL: results = (int32_t)((uint32_t)rs_val >> rt_val); break;
         case OP_JAL:
             // Link value is the next sequential instruction address (10-bit PC)
-            results = (int32_t)((core->pipe.execute.pc + 1) & 0x3FF);
+            results = (int32_t)((core->pipe.execute.pc + 1) & ctx->config.pc_mask);
             break;
         case OP_LW:
         case OP_SW:
@@ -100,24 +198,14 @@ void execute_stage(Core * core){
     core->pipe.execute.result = results;
 }
 
-void decode_stage(Core * core){
+void decode_stage(SimContext * ctx, Core * core){
     if (core == NULL) return;
     if (core->pipe.decode.active == 0) return;
 
     // Important: don't "stick" forever. Re-evaluate hazards every cycle.
     core->pipe.decode.stall = false;
 
-    Instruction * inst = &core->pipe.decode.inst;
-    uint32_t binary_raw = inst->binary_value;
-
-    inst->opcode = (Opcode)((binary_raw >> 24) & 0xFF);
-    inst->rd = (uint8_t)((binary_raw >> 20) & 0xF);
-    inst->rs = (uint8_t)((binary_raw >> 16) & 0xF);
-    inst->rt = (uint8_t)((binary_raw >> 12) & 0xF);
-    
-    int32_t imm12 = binary_raw & 0xFFF;
-    if (imm12 & 0x800) imm12 |= 0xFFFFF000;
-    inst->imm = imm12;
+    const Instruction * inst = core->pipe.decode.inst;
 
     // R0 is hard-wired to 0, and R1 is the sign-extended immediate of the
     // instruction in DECODE
@@ -129,33 +217,50 @@ void decode_stage(Core * core){
     int32_t rd_val = (inst->rd != 1) ? core->regs[inst->rd] : inst->imm;
 
     // --- HAZARD DETECTION (RAW) ---
-    bool hazard = false;
     // No forwarding, and register writes are only visible on the NEXT cycle.
     // Therefore, we must stall if the needed source reg is being written by
     // an instruction currently in EXEC, MEM, or WB.
-    PipelineStage * stages[3] = { &core->pipe.execute, &core->pipe.mem, &core->pipe.wb };
-    
-    for (int i = 0; i < 3; ++i) {
-        uint8_t dest_reg = 0;
-        if (stage_writes_reg(stages[i], &dest_reg)) {
-            if (dest_reg == 0 || dest_reg == 1) continue; // R0 is 0, R1 is immediate-only
-
-            // Check specific source registers required by current opcode
-            if (opcode_reads_rs(inst->opcode) && inst->rs == dest_reg) hazard = true;
-            if (opcode_reads_rt(inst->opcode) && inst->rt == dest_reg) hazard = true;
-            if (opcode_reads_rd(inst->opcode) && inst->rd == dest_reg) hazard = true;
-        }
+    bool hazard;
+    if (ctx->config.forwarding) {
+        // Branches and JAL use their operands right here, everything else in EXEC / MEM
+        bool used_in_decode = inst->opcode >= OP_BEQ && inst->opcode <= OP_JAL;
+        hazard = (opcode_reads_rs(inst->opcode) && !forward_operand(core, inst->rs, used_in_decode, &rs_val)) ||
+                 (opcode_reads_rt(inst->opcode) && !forward_operand(core, inst->rt, used_in_decode, &rt_val)) ||
+                 (opcode_reads_rd(inst->opcode) && !forward_operand(core, inst->rd, used_in_decode, &rd_val));
+    } else {
+        uint16_t pending_dst = stage_dst_mask(&core->pipe.execute) |
+                               stage_dst_mask(&core->pipe.mem) |
+                               stage_dst_mask(&core->pipe.wb);
+        hazard = (inst->src_mask & pending_dst) != 0;
+    }
+    if (ctx->config.mshrs > 0) {
+        // Scoreboard: sources and (WAW) destination of loads still in an MSHR.
+        hazard = hazard || ((inst->src_mask | inst->dst_mask) & core->pending_loads) != 0;
+    }
+    if (inst->opcode == OP_HALT && (ctx->config.mshrs > 0 || ctx->config.store_buffer > 0)) {
+        // HALT waits until every miss is back and every store is in the cache,
+        // including those of the LW / SW still on their way to MEM
+        hazard = hazard || mshr_in_use(ctx, core) > 0 || core->sb_count > 0 ||
+                 stage_is_memory_op(&core->pipe.execute) || stage_is_memory_op(&core->pipe.mem);
+    }
+    if (inst->opcode == OP_HALT && ctx->config.prefetch != PREFETCH_NONE) {
+        // A prefetch may be flushing a dirty victim, let it finish
+        hazard = hazard || core->prefetch_interface.has_pending_request;
     }
 
     if (hazard) {
         core->pipe.decode.stall = true;
         core->stats.decode_stall++;
+        if (core->profile) profile_decode_stall(core, inst);
         return; // STALL!
     }
+    core->pipe.decode.rs_val = rs_val;
+    core->pipe.decode.rt_val = rt_val;
+    core->pipe.decode.rd_val = rd_val;
 
     // Branch / Jump Handling (branch resolution in DECODE, with 1 delay-slot)
     bool taken = false;
-    uint32_t target = (uint32_t)rd_val & 0x3FF;
+    uint32_t target = (uint32_t)rd_val & ctx->config.pc_mask;
     
     switch (inst->opcode) {
         case OP_BEQ: if (rs_val == rt_val) taken = true; break;
@@ -184,7 +289,7 @@ void decode_stage(Core * core){
     }
 }
 
-void fetch_stage(Core * core){
+void fetch_stage(SimContext * ctx, Core * core){
     if (core == NULL) return;
     // Once HALT was decoded, we stop fetching, but the pipeline can still drain.
     if (core->halted || core->stop_fetch) return;
@@ -192,22 +297,77 @@ void fetch_stage(Core * core){
     // If stalled, we cannot fetch new instructions
     if (core->pipe.decode.stall || core->pipe.mem.stall) return;
 
-    uint32_t pc = core->pc & 0x3FF;
-    core->pipe.fetch.inst.binary_value = core->imem[pc];
+    uint32_t pc = core->pc & ctx->config.pc_mask;
+    core->pipe.fetch.inst = &core->program[pc];
     core->pipe.fetch.pc = pc;
     core->pipe.fetch.active = true;
     
-    core->pc = (pc + 1) & 0x3FF;
+    core->pc = (pc + 1) & ctx->config.pc_mask;
 
     // Apply branch/jump redirect after fetching the delay-slot instruction.
     if (core->pc_redirect_valid) {
-        core->pc = core->pc_redirect & 0x3FF;
+        core->pc = core->pc_redirect & ctx->config.pc_mask;
         core->pc_redirect_valid = false;
     }
 }
 
-void memory_stage(Core * core){
+// SW data of the instruction in MEM. Without forwarding it is read from the
+// register file here, as it always was (R1 then holds a later immediate).
+static uint32_t store_data(SimContext* ctx, const Core* core) {
+    if (ctx->config.forwarding) return (uint32_t)core->pipe.mem.rd_val;
+    return (uint32_t)core->regs[core->pipe.mem.inst->rd];
+}
+
+// The MSHRs and the store buffer share the core's bus interface with MEM.
+// A stalled LW waits for a free MSHR (or the data), a SW for room in the store
+// buffer. Anything else retries once the interface is free, a request_done
+// left over after mshr_step() / store_buffer_step() is MEM's own.
+static void retry_shared_interface(SimContext * ctx, Core * core){
+    BusInterface* bi = &core->bus_interface;
+    uint32_t addr = core->pipe.mem.result;
+    bool is_load = core->pipe.mem.inst->opcode == OP_LW;
+    bool own_done = bi->request_done;
+    bi->request_done = false;
+
+    if (is_load && is_cache_hit(ctx, &core->cache, addr)) {
+        core->pipe.mem.result = read_word_from_cache(ctx, &core->cache, addr);
+        core->pipe.mem.stall = false;
+        return;
+    }
+    if (is_load && ctx->config.store_buffer > 0 && store_buffer_conflicts(ctx, core, addr)) return;
+    if (is_load && ctx->config.mshrs > 0) {
+        if (mshr_allocate(ctx, core, addr, core->pipe.mem.inst->rd)) {
+            core->pipe.mem.load_pending = true;
+            core->pipe.mem.stall = false;
+        }
+        return;
+    }
+    if (!is_load && ctx->config.store_buffer > 0) {
+        if (store_buffer_push(ctx, core, addr, store_data(ctx, core))) core->pipe.mem.stall = false;
+        return;
+    }
+
+    if (!own_done && bi->has_pending_request) return;
+    if (is_load) {
+        send_bus_read_request(ctx, core, addr, false);
+    } else if (write_word_to_cache(ctx, core, addr, store_data(ctx, core))) {
+        core->pipe.mem.stall = false;
+    }
+}
+
+void memory_stage(SimContext * ctx, Core * core){
     if (core == NULL) return;
+
+    if (ctx->config.prefetch != PREFETCH_NONE) prefetch_step(ctx, core);
+
+    if (ctx->config.mshrs > 0 || ctx->config.store_buffer > 0) {
+        if (ctx->config.mshrs > 0) mshr_step(ctx, core);
+        if (ctx->config.store_buffer > 0) store_buffer_step(ctx, core);
+        if (core->pipe.mem.stall) {
+            retry_shared_interface(ctx, core);
+            return;
+        }
+    }
     
     // 1. Resolve Existing Stall
     if (core->pipe.mem.stall) {
@@ -218,18 +378,18 @@ void memory_stage(Core * core){
             uint32_t addr = core->pipe.mem.result;
             bool success = false;
             
-            if (core->pipe.mem.inst.opcode == OP_LW) {
-                if (is_cache_hit(&core->cache, addr)) {
-                    core->pipe.mem.result = read_word_from_cache(&core->cache, addr);
+            if (core->pipe.mem.inst->opcode == OP_LW) {
+                if (is_cache_hit(ctx, &core->cache, addr)) {
+                    core->pipe.mem.result = read_word_from_cache(ctx, &core->cache, addr);
                     // Miss was already counted when we first detected it.
                     success = true;
                 } else {
                      // Still missed (rare, maybe evicted by snoop?), retry bus
-                     send_bus_read_request(core, addr, false);
+                     send_bus_read_request(ctx, core, addr, false);
                 }
-            } else if (core->pipe.mem.inst.opcode == OP_SW) {
-                uint32_t data = core->regs[core->pipe.mem.inst.rd];
-                if (write_word_to_cache(core, addr, data)) {
+            } else if (core->pipe.mem.inst->opcode == OP_SW) {
+                uint32_t data = store_data(ctx, core);
+                if (write_word_to_cache(ctx, core, addr, data)) {
                     // Miss was already counted when we first detected it.
                     success = true;
                 }
@@ -246,22 +406,47 @@ void memory_stage(Core * core){
     // 2. Normal Execution
     if (!core->pipe.mem.active) return;
 
-    Opcode op = core->pipe.mem.inst.opcode;
+    Opcode op = core->pipe.mem.inst->opcode;
     uint32_t addr = core->pipe.mem.result; 
+
+    if (ctx->config.prefetch != PREFETCH_NONE && (op == OP_LW || op == OP_SW)) {
+        prefetch_observe(ctx, core, core->pipe.mem.pc, addr);
+    }
     
     if (op == OP_LW) {
-        if (is_cache_hit(&core->cache, addr)) {
-            core->pipe.mem.result = read_word_from_cache(&core->cache, addr);
+        uint32_t buffered;
+        if (ctx->config.store_buffer > 0 && store_buffer_forward(ctx, core, addr, &buffered)) {
+            // The youngest older store to the address, still in the store buffer
+            core->pipe.mem.result = buffered;
+            core->stats.read_hits++;
+            core->stats.sb_forwards++;
+        } else if (is_cache_hit(ctx, &core->cache, addr)) {
+            core->pipe.mem.result = read_word_from_cache(ctx, &core->cache, addr);
             core->stats.read_hits++;
         } else {
             core->stats.read_misses++;
-            send_bus_read_request(core, addr, false);
-            core->pipe.mem.stall = true;
+            if (core->profile) core->profile[core->pipe.mem.pc].misses++;
+            if (ctx->config.classify_misses) note_miss(ctx, core, addr);
+            if (ctx->config.store_buffer > 0 && store_buffer_conflicts(ctx, core, addr)) {
+                core->pipe.mem.stall = true; // Until the stores drained, see retry_shared_interface()
+            } else if (ctx->config.mshrs == 0) {
+                send_bus_read_request(ctx, core, addr, false);
+                core->pipe.mem.stall = true;
+            } else if (mshr_allocate(ctx, core, addr, core->pipe.mem.inst->rd)) {
+                core->pipe.mem.load_pending = true; // Hit under miss from here on
+            } else {
+                core->pipe.mem.stall = true; // No MSHR free
+            }
         }
     } else if (op == OP_SW) {
-        uint32_t val = core->regs[core->pipe.mem.inst.rd];
-        if (!write_word_to_cache(core, addr, val)) {
+        uint32_t val = store_data(ctx, core);
+        if (ctx->config.store_buffer > 0) {
+            // Retires into the store buffer, which counts the hit or miss
+            if (!store_buffer_push(ctx, core, addr, val)) core->pipe.mem.stall = true; // Full
+        } else if (!write_word_to_cache(ctx, core, addr, val)) {
             core->stats.write_misses++;
+            if (core->profile) core->profile[core->pipe.mem.pc].misses++;
+            if (ctx->config.classify_misses) note_miss(ctx, core, addr);
             core->pipe.mem.stall = true; // Stall for ownership/miss
         } else {
             core->stats.write_hits++;
@@ -272,8 +457,9 @@ void memory_stage(Core * core){
 void writeback_stage(Core* core) {
     if (core == NULL || !core->pipe.wb.active) return;
 
-    Instruction* inst = &core->pipe.wb.inst;
+    const Instruction* inst = core->pipe.wb.inst;
     core->stats.instructions++;
+    if (core->profile) core->profile[core->pipe.wb.pc].retired++;
 
     if (inst->opcode == OP_HALT) {
         core->halted = true;
@@ -281,16 +467,29 @@ void writeback_stage(Core* core) {
     }
 
     // Commit register writes on the clock edge (handled in main.c).
-    if (inst->opcode == OP_JAL) {
+    // JAL writes the link register R15, arithmetic/lw write RD.
+    if (inst->writes_dst && !core->pipe.wb.load_pending) {
         core->pending_reg_write = true;
-        core->pending_reg_dst = 15;
+        core->pending_reg_dst = inst->dst;
         core->pending_reg_value = core->pipe.wb.result;
-        return;
     }
+}
+bool pipeline_empty(const Core* c) {
+    return !c->pipe.fetch.active && !c->pipe.decode.active && !c->pipe.execute.active &&
+           !c->pipe.mem.active && !c->pipe.wb.active;
+}
 
-    if (opcode_writes_rd(inst->opcode)) {
-        core->pending_reg_write = true;
-        core->pending_reg_dst = inst->rd;
-        core->pending_reg_value = core->pipe.wb.result;
-    }
+bool run_core_stages(SimContext * ctx, Core * core) {
+    // Run stages while there is still pipeline activity to drain.
+    if (core->halted && pipeline_empty(core)) return false;
+
+    // Stages usually run "Reverse" in software sim to avoid 
+    // data racing within the cycle, but here we use a latching 
+    // function at the end, so order matters less, except for forwarding.
+    writeback_stage(core);
+    memory_stage(ctx, core);
+    execute_stage(ctx, core);
+    decode_stage(ctx, core);
+    fetch_stage(ctx, core);
+    return true;
 }
\ No newline at end of file
@@ -2,8 +2,17 @@
 #include "general_utils.h"
 
 
-void fetch_stage(Core * core);
-void decode_stage(Core * core);
-void execute_stage(Core * core);
-void memory_stage(Core * core);
-void writeback_stage(Core* core);
\ No newline at end of file
+void predecode_imem(SimContext * ctx, Core * core);
+void fetch_stage(SimContext * ctx, Core * core);
+void decode_stage(SimContext * ctx, Core * core);
+void execute_stage(SimContext * ctx, Core * core);
+void memory_stage(SimContext * ctx, Core * core);
+void writeback_stage(Core* core);
+
+// Runs all five stages of one cycle, returns false once the core halted and drained
+bool run_core_stages(SimContext * ctx, Core * core);
+bool pipeline_empty(const Core* c);
+
+// Profile (config.profile) of count more copies of a cycle that left the
+// core unchanged and changed its stats by delta, see fast_forward_apply()
+void profile_repeat_cycle(Core* core, const CoreStats* delta, int count);
\ No newline at end of file
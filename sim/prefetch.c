@@ -0,0 +1,85 @@
+#include "prefetch.h"
+#include "memory.h"
+#include "bus.h"
+
+static uint32_t block_of(SimContext* ctx, uint32_t address) {
+    return (address & (MEMIN_DEPTH - 1)) & ~(uint32_t)(ctx->config.block_size - 1);
+}
+
+static void queue_block(SimContext* ctx, Core* core, uint32_t address) {
+    Prefetcher* pf = &core->prefetcher;
+    const BusInterface* pi = &core->prefetch_interface;
+    uint32_t block = block_of(ctx, address);
+    if (find_cache_line(ctx, &core->cache, block) >= 0) return;
+    if (pi->has_pending_request && pi->request.bus_addr == block) return;
+    for (int i = 0; i < pf->queue_count; i++) {
+        if (pf->queue[(pf->queue_head + i) % PREFETCH_QUEUE_SIZE] == block) return;
+    }
+
+    // Full: the oldest candidate is the least likely to still be in time
+    if (pf->queue_count == PREFETCH_QUEUE_SIZE) {
+        pf->queue_head = (pf->queue_head + 1) % PREFETCH_QUEUE_SIZE;
+        pf->queue_count--;
+    }
+    pf->queue[(pf->queue_head + pf->queue_count) % PREFETCH_QUEUE_SIZE] = block;
+    pf->queue_count++;
+}
+
+static void observe_next_line(SimContext* ctx, Core* core, uint32_t address) {
+    int line = find_cache_line(ctx, &core->cache, address);
+    bool trigger = line < 0 || core->cache.prefetched[line];
+    if (!trigger) return;
+
+    uint32_t block = block_of(ctx, address);
+    for (int n = 1; n <= ctx->config.prefetch_degree; n++) {
+        queue_block(ctx, core, block + (uint32_t)(n * ctx->config.block_size));
+    }
+}
+
+static void observe_stride(SimContext* ctx, Core* core, uint32_t pc, uint32_t address) {
+    StrideEntry* entry = &core->prefetcher.stride_table[pc % STRIDE_TABLE_SIZE];
+    if (entry->pc != pc) {
+        entry->pc = pc;
+        entry->last_address = address;
+        entry->stride = 0;
+        entry->confidence = 0;
+        return;
+    }
+
+    int32_t stride = (int32_t)(address - entry->last_address);
+    if (stride != 0 && stride == entry->stride) {
+        if (entry->confidence < 3) entry->confidence++;
+    } else {
+        entry->stride = stride;
+        entry->confidence = 0;
+    }
+    entry->last_address = address;
+
+    // Seen twice in a row before we trust it
+    if (entry->confidence < 2) return;
+    for (int n = 1; n <= ctx->config.prefetch_degree; n++) {
+        uint32_t target = address + (uint32_t)(n * stride);
+        if (block_of(ctx, target) != block_of(ctx, address)) queue_block(ctx, core, target);
+    }
+}
+
+void prefetch_observe(SimContext* ctx, Core* core, uint32_t pc, uint32_t address) {
+    if (ctx->config.prefetch == PREFETCH_NEXT_LINE) observe_next_line(ctx, core, address);
+    else if (ctx->config.prefetch == PREFETCH_STRIDE) observe_stride(ctx, core, pc, address);
+}
+
+void prefetch_step(SimContext* ctx, Core* core) {
+    Prefetcher* pf = &core->prefetcher;
+    // After HALT nothing new goes out, so the core can drain (see decode_stage())
+    if (core->stop_fetch || core->prefetch_interface.has_pending_request) return;
+
+    while (pf->queue_count > 0) {
+        uint32_t block = pf->queue[pf->queue_head];
+        pf->queue_head = (pf->queue_head + 1) % PREFETCH_QUEUE_SIZE;
+        pf->queue_count--;
+        if (find_cache_line(ctx, &core->cache, block) < 0) {
+            send_prefetch_request(core, block);
+            return;
+        }
+    }
+}
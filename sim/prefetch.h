@@ -0,0 +1,15 @@
+#pragma once
+#include "general_utils.h"
+
+// Hardware prefetchers (config.prefetch). MEM reports every LW / SW
+// address, the prefetcher queues the blocks it expects next and posts them
+// one at a time as low priority BusRd requests (see send_prefetch_request()).
+//   next_line: a demand miss, or the first use of a prefetched line, of block
+//              B queues B + 1 ... B + prefetch_degree
+//   stride:    a PC whose last accesses were a constant stride apart queues
+//              the next prefetch_degree addresses of that stride
+
+// Called by MEM before the access of the LW / SW at pc
+void prefetch_observe(SimContext* ctx, Core* core, uint32_t pc, uint32_t address);
+// Once per cycle: post the next queued block if the prefetch interface is free
+void prefetch_step(SimContext* ctx, Core* core);
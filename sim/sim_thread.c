@@ -0,0 +1,288 @@
+#include "sim_thread.h"
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#include <share.h>
+#include <sys/stat.h>
+#include <psapi.h>
+#else
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#endif
+
+// The thread entry point signature differs between platforms, so every thread
+// starts in a small trampoline that unpacks the real function and argument.
+typedef struct {
+    SimThreadFunc func;
+    void* arg;
+} ThreadStart;
+
+#ifdef _WIN32
+
+static DWORD WINAPI thread_trampoline(LPVOID param) {
+    ThreadStart start = *(ThreadStart*)param;
+    free(param);
+    start.func(start.arg);
+    return 0;
+}
+
+bool sim_thread_create(SimThread* thread, SimThreadFunc func, void* arg) {
+    ThreadStart* start = (ThreadStart*)malloc(sizeof(ThreadStart));
+    if (!start) return false;
+    start->func = func;
+    start->arg = arg;
+    *thread = CreateThread(NULL, 0, thread_trampoline, start, 0, NULL);
+    if (*thread == NULL) {
+        free(start);
+        return false;
+    }
+    return true;
+}
+
+void sim_thread_join(SimThread thread) {
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+}
+
+void sim_mutex_init(SimMutex* mutex) { InitializeSRWLock(mutex); }
+void sim_mutex_destroy(SimMutex* mutex) { (void)mutex; }
+void sim_mutex_lock(SimMutex* mutex) { AcquireSRWLockExclusive(mutex); }
+void sim_mutex_unlock(SimMutex* mutex) { ReleaseSRWLockExclusive(mutex); }
+
+void sim_cond_init(SimCond* cond) { InitializeConditionVariable(cond); }
+void sim_cond_destroy(SimCond* cond) { (void)cond; }
+void sim_cond_wait(SimCond* cond, SimMutex* mutex) { SleepConditionVariableSRW(cond, mutex, INFINITE, 0); }
+void sim_cond_broadcast(SimCond* cond) { WakeAllConditionVariable(cond); }
+
+int sim_cpu_count(void) {
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? (int)info.dwNumberOfProcessors : 1;
+}
+
+double sim_wall_time(void) {
+    LARGE_INTEGER freq, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (double)now.QuadPart / (double)freq.QuadPart;
+}
+
+static bool make_one_dir(const char* path) {
+    return CreateDirectoryA(path, NULL) || GetLastError() == ERROR_ALREADY_EXISTS;
+}
+
+bool sim_truncate_file(const char* path, long long size) {
+    struct _stat64 info;
+    if (_stat64(path, &info) != 0 || info.st_size < size) return false;
+    int fd;
+    if (_sopen_s(&fd, path, _O_RDWR | _O_BINARY, _SH_DENYNO, _S_IREAD | _S_IWRITE) != 0) return false;
+    bool ok = _chsize_s(fd, size) == 0;
+    _close(fd);
+    return ok;
+}
+
+long long sim_peak_memory_kb(void) {
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+    return (long long)(counters.PeakWorkingSetSize / 1024);
+}
+
+void sim_reset_peak_memory(void) {}
+
+#else
+
+static void* thread_trampoline(void* param) {
+    ThreadStart start = *(ThreadStart*)param;
+    free(param);
+    start.func(start.arg);
+    return NULL;
+}
+
+bool sim_thread_create(SimThread* thread, SimThreadFunc func, void* arg) {
+    ThreadStart* start = (ThreadStart*)malloc(sizeof(ThreadStart));
+    if (!start) return false;
+    start->func = func;
+    start->arg = arg;
+    if (pthread_create(thread, NULL, thread_trampoline, start) != 0) {
+        free(start);
+        return false;
+    }
+    return true;
+}
+
+void sim_thread_join(SimThread thread) { pthread_join(thread, NULL); }
+
+void sim_mutex_init(SimMutex* mutex) { pthread_mutex_init(mutex, NULL); }
+void sim_mutex_destroy(SimMutex* mutex) { pthread_mutex_destroy(mutex); }
+void sim_mutex_lock(SimMutex* mutex) { pthread_mutex_lock(mutex); }
+void sim_mutex_unlock(SimMutex* mutex) { pthread_mutex_unlock(mutex); }
+
+void sim_cond_init(SimCond* cond) { pthread_cond_init(cond, NULL); }
+void sim_cond_destroy(SimCond* cond) { pthread_cond_destroy(cond); }
+void sim_cond_wait(SimCond* cond, SimMutex* mutex) { pthread_cond_wait(cond, mutex); }
+void sim_cond_broadcast(SimCond* cond) { pthread_cond_broadcast(cond); }
+
+int sim_cpu_count(void) {
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (int)count : 1;
+}
+
+double sim_wall_time(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+static bool make_one_dir(const char* path) {
+    return mkdir(path, 0777) == 0 || errno == EEXIST;
+}
+
+bool sim_truncate_file(const char* path, long long size) {
+    struct stat info;
+    if (stat(path, &info) != 0 || (long long)info.st_size < size) return false;
+    return truncate(path, (off_t)size) == 0;
+}
+
+long long sim_peak_memory_kb(void) {
+#ifdef __linux__
+    // VmHWM follows the resets below, ru_maxrss does not
+    FILE* status = fopen("/proc/self/status", "r");
+    if (status) {
+        char line[256];
+        long long peak = -1;
+        while (peak < 0 && fgets(line, sizeof(line), status)) {
+            if (strncmp(line, "VmHWM:", 6) == 0) peak = atoll(line + 6);
+        }
+        fclose(status);
+        if (peak >= 0) return peak;
+    }
+#endif
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+    return (long long)usage.ru_maxrss / 1024; // Bytes
+#else
+    return (long long)usage.ru_maxrss;
+#endif
+}
+
+void sim_reset_peak_memory(void) {
+#ifdef __linux__
+    FILE* clear_refs = fopen("/proc/self/clear_refs", "w");
+    if (clear_refs) {
+        fputs("5", clear_refs);
+        fclose(clear_refs);
+    }
+#endif
+}
+
+#endif
+
+bool sim_make_dir(const char* path) {
+    if (path[0] == '\0') return true; // The working directory
+    char* partial = (char*)malloc(strlen(path) + 1);
+    if (!partial) return false;
+    strcpy(partial, path);
+
+    // Create the parents first, one separator at a time
+    bool ok = true;
+    for (char* p = partial + 1; ok && *p; p++) {
+        if (*p != '/' && *p != '\\') continue;
+        char separator = *p;
+        *p = '\0';
+        ok = make_one_dir(partial);
+        *p = separator;
+    }
+    if (ok) ok = make_one_dir(partial);
+    free(partial);
+    return ok;
+}
+
+#ifdef _WIN32
+#define ATOMIC_LOAD(p) InterlockedCompareExchange((p), 0, 0)
+#define ATOMIC_STORE(p, v) InterlockedExchange((p), (v))
+#else
+#define ATOMIC_LOAD(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define ATOMIC_STORE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#endif
+
+#ifdef _WIN32
+
+void sim_atomic_or64(volatile uint64_t* mask, uint64_t bits) {
+    InterlockedOr64((volatile LONG64*)mask, (LONG64)bits);
+}
+
+void sim_atomic_and64(volatile uint64_t* mask, uint64_t bits) {
+    InterlockedAnd64((volatile LONG64*)mask, (LONG64)bits);
+}
+
+int sim_lowest_bit64(uint64_t mask) {
+    unsigned long index;
+    _BitScanForward64(&index, mask);
+    return (int)index;
+}
+
+int sim_popcount64(uint64_t mask) {
+    return (int)__popcnt64(mask);
+}
+
+#else
+
+void sim_atomic_or64(volatile uint64_t* mask, uint64_t bits) {
+    __atomic_fetch_or(mask, bits, __ATOMIC_RELAXED);
+}
+
+void sim_atomic_and64(volatile uint64_t* mask, uint64_t bits) {
+    __atomic_fetch_and(mask, bits, __ATOMIC_RELAXED);
+}
+
+int sim_lowest_bit64(uint64_t mask) {
+    return __builtin_ctzll(mask);
+}
+
+int sim_popcount64(uint64_t mask) {
+    return __builtin_popcountll(mask);
+}
+
+#endif
+
+void sim_barrier_init(SimBarrier* barrier, int count) {
+    sim_mutex_init(&barrier->lock);
+    sim_cond_init(&barrier->cond);
+    barrier->count = count;
+    barrier->waiting = 0;
+    barrier->generation = 0;
+}
+
+void sim_barrier_destroy(SimBarrier* barrier) {
+    sim_cond_destroy(&barrier->cond);
+    sim_mutex_destroy(&barrier->lock);
+}
+
+void sim_barrier_wait(SimBarrier* barrier) {
+    sim_mutex_lock(&barrier->lock);
+    long generation = barrier->generation;
+    if (++barrier->waiting == barrier->count) {
+        // Last one in releases everybody
+        barrier->waiting = 0;
+        ATOMIC_STORE(&barrier->generation, generation + 1);
+        sim_cond_broadcast(&barrier->cond);
+        sim_mutex_unlock(&barrier->lock);
+        return;
+    }
+    sim_mutex_unlock(&barrier->lock);
+
+    for (int i = 0; i < SIM_BARRIER_SPIN; i++) {
+        if (ATOMIC_LOAD(&barrier->generation) != generation) return;
+    }
+
+    sim_mutex_lock(&barrier->lock);
+    while (barrier->generation == generation) {
+        sim_cond_wait(&barrier->cond, &barrier->lock);
+    }
+    sim_mutex_unlock(&barrier->lock);
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include "general_utils.h"
+
+// Minimal threading layer so the simulator builds both with the makefile
+// (pthreads) and with the Visual Studio project (Win32 threads).
+
+#ifdef _WIN32
+#include <windows.h>
+typedef HANDLE SimThread;
+typedef SRWLOCK SimMutex;
+typedef CONDITION_VARIABLE SimCond;
+#else
+#include <pthread.h>
+typedef pthread_t SimThread;
+typedef pthread_mutex_t SimMutex;
+typedef pthread_cond_t SimCond;
+#endif
+
+typedef void (*SimThreadFunc)(void* arg);
+
+bool sim_thread_create(SimThread* thread, SimThreadFunc func, void* arg);
+void sim_thread_join(SimThread thread);
+
+void sim_mutex_init(SimMutex* mutex);
+void sim_mutex_destroy(SimMutex* mutex);
+void sim_mutex_lock(SimMutex* mutex);
+void sim_mutex_unlock(SimMutex* mutex);
+
+void sim_cond_init(SimCond* cond);
+void sim_cond_destroy(SimCond* cond);
+void sim_cond_wait(SimCond* cond, SimMutex* mutex);
+void sim_cond_broadcast(SimCond* cond);
+
+// Number of hardware threads (at least 1), used to size worker pools
+int sim_cpu_count(void);
+
+// Monotonic wall clock in seconds, used to report phase timings
+double sim_wall_time(void);
+
+// Create a directory and its parents, true if it exists afterwards
+bool sim_make_dir(const char* path);
+
+// Cut a file down to size bytes, false if it is missing or shorter
+bool sim_truncate_file(const char* path, long long size);
+
+// Peak resident memory of the process in KiB, 0 if unknown. Where the OS
+// allows it (Linux) the reset starts a new peak at the current size, so a
+// benchmark can measure its runs one after another; elsewhere the peak is
+// the one of the whole process.
+long long sim_peak_memory_kb(void);
+void sim_reset_peak_memory(void);
+
+// Atomic bit operations on a 64 bit mask, for bitmaps that pipeline stages
+// running on different threads update (see SystemBus.pending_requests)
+void sim_atomic_or64(volatile uint64_t* mask, uint64_t bits);
+void sim_atomic_and64(volatile uint64_t* mask, uint64_t bits);
+
+// Index of the lowest set bit, mask must not be 0
+int sim_lowest_bit64(uint64_t mask);
+
+// Number of set bits
+int sim_popcount64(uint64_t mask);
+
+// Reusable barrier for a fixed number of threads. Waiters spin for a short
+// while before sleeping, since the simulator crosses it twice per cycle.
+#define SIM_BARRIER_SPIN 4096
+
+typedef struct {
+    SimMutex lock;
+    SimCond cond;
+    int count;
+    int waiting;
+    volatile long generation;
+} SimBarrier;
+
+void sim_barrier_init(SimBarrier* barrier, int count);
+void sim_barrier_destroy(SimBarrier* barrier);
+void sim_barrier_wait(SimBarrier* barrier);
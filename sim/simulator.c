@@ -0,0 +1,374 @@
+#include "simulator.h"
+#include "pipeline.h"
+#include "bus.h"
+#include "memory.h"
+#include "checkpoint.h"
+#include "miss_class.h"
+
+static Core* create_core(SimContext* ctx, int id) {
+    Core* core = (Core*)calloc(1, sizeof(Core));
+    if (!core) return NULL;
+    core->id = id;
+    core->pc = 0;
+    core->imem = (uint32_t*)calloc((size_t)ctx->config.imem_depth, sizeof(uint32_t));
+    core->program = (Instruction*)calloc((size_t)ctx->config.imem_depth, sizeof(Instruction));
+    if (ctx->config.profile) {
+        core->profile = (PcProfile*)calloc((size_t)ctx->config.imem_depth, sizeof(PcProfile));
+        if (core->profile) {
+            for (int pc = 0; pc < ctx->config.imem_depth; pc++) core->profile[pc].producer = -1;
+        }
+    }
+    if (!core->imem || !core->program || (ctx->config.profile && !core->profile) || !init_cache(ctx, &core->cache, id)) {
+        free_cache(&core->cache);
+        free(core->imem);
+        free(core->program);
+        free(core->profile);
+        free(core);
+        return NULL;
+    }
+    return core;
+}
+
+static void free_core(Core* core) {
+    if (core == NULL) return;
+    free_cache(&core->cache);
+    free(core->imem);
+    free(core->program);
+    free(core->profile);
+    free(core);
+}
+
+// Commit register writes on the clock edge (end of cycle)
+static void commit_register_writes(Core* c) {
+    if (c == NULL) return;
+
+    // R0 is hard-wired to 0
+    c->regs[0] = 0;
+
+    // R1: immediate register (only updated from decode)
+    if (c->pending_imm_write) {
+        c->regs[1] = c->pending_imm_value;
+        c->pending_imm_write = false;
+    }
+
+    // Load data delivered by an MSHR (never the register WB writes, see decode_stage())
+    if (c->pending_fill_mask) {
+        for (int r = 2; r < REGISTER_COUNT; r++) {
+            if (c->pending_fill_mask & (1 << r)) c->regs[r] = c->pending_fill_value[r];
+        }
+        c->pending_loads &= (uint16_t)~c->pending_fill_mask;
+        c->pending_fill_mask = 0;
+    }
+
+    // General reg write (from WB)
+    if (c->pending_reg_write) {
+        uint8_t dst = c->pending_reg_dst;
+        if (dst != 0 && dst != 1) {
+            c->regs[dst] = c->pending_reg_value;
+        }
+        c->pending_reg_write = false;
+    }
+
+    // Keep invariants
+    c->regs[0] = 0;
+}
+
+// Helper to advance pipeline stages (latching)
+static void update_pipeline_stages(SimContext * ctx, Core * core) {
+    if (core == NULL) return;
+
+    // Pipeline register update happens on the clock edge.
+    // Use temporaries so we don't accidentally reuse the same instruction twice.
+    PipelineStage next_wb     = core->pipe.wb;
+    PipelineStage next_mem    = core->pipe.mem;
+    PipelineStage next_exec   = core->pipe.execute;
+    PipelineStage next_decode = core->pipe.decode;
+    PipelineStage next_fetch  = core->pipe.fetch;
+
+    if (ctx->config.mshrs > 0) {
+        int in_use = mshr_in_use(ctx, core);
+        if (in_use > 0) {
+            core->stats.miss_cycles++;
+            core->stats.mshr_occupancy += in_use;
+            if (!core->pipe.mem.stall && !core->pipe.decode.stall && core->pipe.decode.active) {
+                core->stats.miss_progress++;
+            }
+        }
+    }
+
+    if (core->pipe.mem.stall) {
+        // Whole pipeline is effectively stalled behind MEM while waiting on the bus.
+        // Nothing advances this cycle (except we count the stall).
+        core->stats.mem_stall++;
+        if (core->profile) core->profile[core->pipe.mem.pc].mem_stall++;
+        return;
+    }
+
+    // WB always takes MEM, MEM takes EXEC.
+    next_wb  = core->pipe.mem;
+    next_mem = core->pipe.execute;
+
+    if (core->pipe.decode.stall) {
+        // Insert bubble into EXEC, keep DECODE and FETCH holding their current instructions.
+        next_exec.active = false;
+    } else {
+        // Normal flow
+        next_exec   = core->pipe.decode;
+        next_decode = core->pipe.fetch;
+
+        // Critical: once FETCH is consumed into DECODE, clear FETCH so we don't
+        // "re-inject" the same instruction if fetch_stage() is blocked next cycle.
+        next_fetch.active = false;
+    }
+
+    core->pipe.wb     = next_wb;
+    core->pipe.mem    = next_mem;
+    core->pipe.execute= next_exec;
+    core->pipe.decode = next_decode;
+    core->pipe.fetch  = next_fetch;
+}
+
+Simulator* sim_create(const SimConfig* config, const SimOptions* options) {
+    Simulator* sim = (Simulator*)calloc(1, sizeof(Simulator));
+    if (!sim) return NULL;
+    SimContext* ctx = &sim->context;
+    ctx->config = *config;
+    sim->options = *options;
+
+    // 1. Initialize System Memory
+    ctx->bus.system_memory = (uint32_t*)calloc(MEMIN_DEPTH, sizeof(uint32_t));
+
+    // 2. Initialize Cores
+    int core_count = ctx->config.core_count;
+    sim->cores = (Core**)calloc((size_t)core_count, sizeof(Core*));
+    sim->active_cores = (int*)malloc((size_t)core_count * sizeof(int));
+    bool ok = ctx->bus.system_memory && sim->cores && sim->active_cores;
+    for (int i = 0; ok && i < core_count; i++) {
+        sim->cores[i] = create_core(ctx, i);
+        ok = sim->cores[i] != NULL;
+    }
+
+    // Link caches/interfaces to the shared system bus (after all cores exist)
+    if (ok) ok = init_bus(ctx, sim->cores);
+    if (!ok) {
+        sim_destroy(sim);
+        return NULL;
+    }
+
+    // Finished cores never run again, so they are dropped from the per-cycle work
+    for (int i = 0; i < core_count; i++) sim->active_cores[sim->active_count++] = i;
+    sim->fast_forward.armed = false;
+    return sim;
+}
+
+bool sim_load(Simulator* sim, SimFiles* files) {
+    SimContext* ctx = &sim->context;
+    sim->files = *files;
+    memset(files, 0, sizeof(*files));
+
+    if (sim->files.restore) {
+        long long* lengths = (long long*)calloc((size_t)ctx->config.core_count + 1, sizeof(long long));
+        if (!lengths || !checkpoint_read(sim, sim->files.restore, lengths)) {
+            free(lengths);
+            return false;
+        }
+        // Per-cycle trace outputs stay open (and buffered) for the whole run
+        reopen_traces(&sim->files, lengths);
+        free(lengths);
+    } else {
+        read_mainmem(&sim->files, ctx->bus.system_memory);
+        if (!read_imem(ctx, &sim->files, sim->cores)) return false;
+        if (sim->options.functional > 0) {
+            double start = sim_wall_time();
+            sim->functional_instructions = functional_run(ctx, sim->cores, ctx->config.core_count, sim->options.functional);
+            sim->functional_ms = (sim_wall_time() - start) * 1000.0;
+        }
+        open_traces(&sim->files);
+    }
+
+    if (sim->options.checkpoint_every > 0) {
+        sim->next_checkpoint = (sim->cycle / sim->options.checkpoint_every + 1) * sim->options.checkpoint_every;
+    }
+    sim->core_pool = core_pool_create(ctx, sim->cores, sim->options.threads);
+    sim->loaded = true;
+    return true;
+}
+
+// <checkpoint><cycle>.bin
+static bool checkpoint_now(Simulator* sim) {
+    char* path = (char*)malloc(strlen(sim->files.checkpoint) + 32);
+    if (!path) return false;
+    sprintf(path, "%s%d.bin", sim->files.checkpoint, sim->cycle);
+    bool ok = checkpoint_write(sim, path);
+    free(path);
+    return ok;
+}
+
+bool sim_checkpoint(Simulator* sim, const char* path) {
+    return checkpoint_write(sim, path);
+}
+
+bool sim_step(Simulator* sim) {
+    if (sim->stopped) return false;
+    SimContext* ctx = &sim->context;
+    Core** cores = sim->cores;
+    ctx->bus.cycle = sim->cycle;
+
+    if (sim->options.fast_forward) {
+        fast_forward_begin_cycle(ctx, &sim->fast_forward, cores, sim->active_cores, sim->active_count);
+    }
+
+    // 1. Run Pipeline Stages (Hardware Parallelism, optionally on worker threads)
+    if (!core_pool_run_stages(sim->core_pool, sim->active_cores, sim->active_count)) {
+        sim->stopped = true;
+        return false;
+    }
+
+    // 2. Bus Arbitration & Transaction
+    bus_handler(ctx);
+
+    // 3. Logging
+    log_core_trace(&sim->files, cores, sim->active_cores, sim->active_count, sim->cycle);
+    log_bus_trace(ctx, &sim->files, sim->cycle);
+
+    // 4. Advance Pipeline (Clock Edge)
+    for (int a = 0; a < sim->active_count; a++) {
+        Core* core = cores[sim->active_cores[a]];
+        // Clock edge: advance pipeline, then commit register file updates.
+        update_pipeline_stages(ctx, core);
+        commit_register_writes(core);
+        if (ctx->config.classify_misses) count_misses(ctx, core);
+        // Count cycles until the core reaches HALT (as defined in the spec)
+        if (!core->halted) {
+            core->stats.cycles++;
+        }
+    }
+
+    sim->cycle++;
+
+    // 5. Skip cycles that would only repeat this one while the bus is busy
+    if (sim->options.fast_forward) {
+        int skip = fast_forward_cycles(ctx, &sim->fast_forward, cores, sim->active_cores, sim->active_count);
+        if (skip > sim->options.max_cycles + 1 - sim->cycle) skip = sim->options.max_cycles + 1 - sim->cycle;
+        // Checkpoints land on their exact cycle
+        if (sim->options.checkpoint_every > 0 && skip > sim->next_checkpoint - sim->cycle) {
+            skip = sim->next_checkpoint - sim->cycle;
+        }
+        if (skip > 0) {
+            DEBUG_PRINT("Fast-forward: cycles %d-%d\n", sim->cycle, sim->cycle + skip - 1);
+            log_repeated_cycles(ctx, &sim->files, cores, sim->active_cores, sim->active_count, sim->cycle, skip);
+            fast_forward_apply(ctx, &sim->fast_forward, cores, sim->active_cores, sim->active_count, skip);
+            sim->cycle += skip;
+        }
+    }
+
+    // Drop cores that halted and drained
+    int still_active = 0;
+    for (int a = 0; a < sim->active_count; a++) {
+        Core* core = cores[sim->active_cores[a]];
+        if (!core->halted || !pipeline_empty(core)) sim->active_cores[still_active++] = sim->active_cores[a];
+    }
+    sim->active_count = still_active;
+
+    if (sim->options.checkpoint_every > 0 && sim->cycle >= sim->next_checkpoint) {
+        checkpoint_now(sim);
+        sim->next_checkpoint += sim->options.checkpoint_every;
+    }
+
+    // Safety break for infinite loops
+    if (sim->cycle > sim->options.max_cycles) {
+        sim->timed_out = true;
+        sim->stopped = true;
+        if (sim->options.checkpoint_on_timeout) checkpoint_now(sim);
+        return false;
+    }
+    return true;
+}
+
+void sim_run(Simulator* sim) {
+    while (sim_step(sim)) {}
+
+    SimContext* ctx = &sim->context;
+    core_pool_destroy(sim->core_pool);
+    sim->core_pool = NULL;
+
+    // Flush the traces on both normal termination and timeout
+    close_traces(ctx, &sim->files);
+
+    if (ctx->config.classify_misses) {
+        for (int i = 0; i < ctx->config.core_count; i++) finish_sharing_misses(ctx, &sim->cores[i]->cache);
+    }
+    write_outputs(ctx, &sim->files, sim->cores, ctx->bus.system_memory);
+    sim->outputs_written = true;
+}
+
+void sim_report(Simulator* sim, FILE* out) {
+    SimContext* ctx = &sim->context;
+    if (sim->options.functional > 0) {
+        fprintf(out, "Functional warm-up: %lld instructions in %.3f ms before cycle 0\n",
+            sim->functional_instructions, sim->functional_ms);
+    }
+    if (sim->timed_out) {
+        fprintf(out, "Timeout reached\n");
+        if (sim->options.checkpoint_on_timeout) {
+            fprintf(out, "Checkpoint at cycle %d: %s%d.bin\n", sim->cycle, sim->files.checkpoint, sim->cycle);
+        }
+    }
+
+    if (ctx->config.protocol != PROTOCOL_MESI) {
+        fprintf(out, "Cache-to-cache transfers: %lld (%lld bus cycles of memory latency saved), memory reads: %lld, flushes: %lld\n",
+            ctx->bus.cache_transfers, ctx->bus.cache_transfers * ctx->config.bus_delay,
+            ctx->bus.memory_reads, ctx->bus.flushes);
+    }
+    if (ctx->config.bus_upgrade) {
+        fprintf(out, "Bus upgrades: %lld, full BusRdX: %lld\n", ctx->bus.upgrades, ctx->bus.rdx_requests);
+    }
+    if (ctx->config.mshrs > 0) {
+        for (int i = 0; i < ctx->config.core_count; i++) {
+            const CoreStats* s = &sim->cores[i]->stats;
+            fprintf(out, "Core %d: %d cycles with misses outstanding (%.2f MSHRs in use on average), %d of them issued an instruction\n",
+                i, s->miss_cycles, s->miss_cycles ? (double)s->mshr_occupancy / s->miss_cycles : 0.0, s->miss_progress);
+        }
+    }
+    if (ctx->config.store_buffer > 0) {
+        for (int i = 0; i < ctx->config.core_count; i++) {
+            const CoreStats* s = &sim->cores[i]->stats;
+            fprintf(out, "Core %d: %d stores went through the store buffer, %d loads were served from it\n",
+                i, s->sb_stores, s->sb_forwards);
+        }
+    }
+    if (ctx->config.prefetch != PREFETCH_NONE) {
+        for (int i = 0; i < ctx->config.core_count; i++) {
+            const Cache* cache = &sim->cores[i]->cache;
+            // Lines still waiting for their first use at exit count as useless too
+            int unused = 0;
+            for (int line = 0; line < ctx->config.tsram_depth; line++) unused += cache->prefetched[line];
+            fprintf(out, "Core %d prefetches: %d issued, %d useful, %d late, %d useless\n",
+                i, cache->prefetch_issued, cache->prefetch_useful, cache->prefetch_late,
+                cache->prefetch_useless + unused);
+        }
+    }
+    if (ctx->config.snoop_filter) {
+        fprintf(out, "Snoop probes: %lld, avoided by the snoop filter: %lld\n",
+            ctx->bus.snoop_probes, ctx->bus.snoop_probes_avoided);
+    }
+
+}
+
+void sim_destroy(Simulator* sim) {
+    if (!sim) return;
+    SimContext* ctx = &sim->context;
+
+    core_pool_destroy(sim->core_pool);
+    if (sim->loaded && !sim->outputs_written) close_traces(ctx, &sim->files);
+
+    free_bus(ctx);
+    free(ctx->bus.system_memory);
+    if (sim->cores) {
+        for (int i = 0; i < ctx->config.core_count; i++) free_core(sim->cores[i]);
+    }
+    free(sim->cores);
+    free(sim->active_cores);
+    free_files(&sim->files);
+    free(sim);
+}
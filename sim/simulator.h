@@ -0,0 +1,61 @@
+#pragma once
+#include "general_utils.h"
+#include "file_io.h"
+#include "core_pool.h"
+#include "fast_forward.h"
+#include "functional.h"
+
+// One simulated machine. Everything a simulation touches hangs off its
+// handle, so any number of them can exist at once:
+//   sim_create(): allocate the machine for a configuration
+//   sim_load():   read memin and the imem files (or restore a checkpoint),
+//                 run the functional warm-up, open the traces
+//   sim_step():   run one cycle (or a fast-forwarded run of cycles)
+//   sim_run():    step until every core halted (or max_cycles), then write
+//                 the output files
+//   sim_checkpoint(): save the whole machine between steps (see checkpoint.h)
+//   sim_report(): print the run summary (timeout, feature statistics)
+//   sim_destroy()
+//
+// The modules take the simulator's context (sim->context) as their first
+// argument, nothing is global: calls for different simulators may interleave
+// on a thread, and separate simulators can run concurrently on different
+// threads (one thread per simulator at a time).
+typedef struct {
+    SimContext context;
+    SimFiles files;
+    SimOptions options;
+    Core** cores;
+    int* active_cores;      // Cores that have not halted and drained yet
+    int active_count;
+    CorePool* core_pool;
+    FastForward fast_forward;
+    int cycle;
+    int next_checkpoint;    // Cycle of the next --checkpoint-every checkpoint
+    long long functional_instructions; // Run by the --functional warm-up, all cores
+    double functional_ms;
+    bool loaded;
+    bool stopped;           // Every core is done, or the cycle limit was hit
+    bool timed_out;
+    bool outputs_written;
+} Simulator;
+
+// config must have been through config_finalize(), NULL on allocation failure
+Simulator* sim_create(const SimConfig* config, const SimOptions* options);
+
+// Takes over files (left empty), must be called once before stepping. With
+// files->restore the run continues from that checkpoint, which must have been
+// written with the same configuration: the traces go on after its cycle.
+// False if the checkpoint cannot be restored or a program does not assemble.
+bool sim_load(Simulator* sim, SimFiles* files);
+
+// Returns false once the simulation is over
+bool sim_step(Simulator* sim);
+
+// Also done every options.checkpoint_every cycles and, with
+// options.checkpoint_on_timeout, when max_cycles is hit (<checkpoint><cycle>.bin)
+bool sim_checkpoint(Simulator* sim, const char* path);
+
+void sim_run(Simulator* sim);
+void sim_report(Simulator* sim, FILE* out);
+void sim_destroy(Simulator* sim);
@@ -0,0 +1,277 @@
+#include "trace_format.h"
+
+#define CORE_FLAG_ACTIVE_MASK 0x1F
+#define CORE_FLAG_PCS_SAME    0x20
+#define CORE_FLAG_PCS_SHIFTED 0x40
+#define CORE_FLAG_CYCLE_NEXT  0x80
+
+#define BUS_FLAG_CYCLE_NEXT   0x01
+#define BUS_FLAG_HEADER_SAME  0x02
+#define BUS_FLAG_DATA_SAME    0x04
+
+// Text format
+
+int format_core_trace(char* line, const CoreTraceRecord* rec) {
+    int len = sprintf(line, "%d ", rec->cycle);
+
+    // FETCH, DECODE, EXEC, MEM, WB
+    for (int s = 0; s < TRACE_STAGE_COUNT; s++) {
+        if (rec->active & (1 << s)) len += sprintf(line + len, "%03X ", rec->pc[s]);
+        else len += sprintf(line + len, "--- ");
+    }
+
+    // Registers R2-R15
+    for (int r = 2; r < REGISTER_COUNT; r++) {
+        len += sprintf(line + len, "%08X", rec->regs[r]);
+        if (r < REGISTER_COUNT - 1) line[len++] = ' ';
+    }
+
+    line[len++] = '\n';
+    line[len] = '\0';
+    return len;
+}
+
+int format_bus_trace(char* line, const BusTraceRecord* rec) {
+    return sprintf(line, "%d %X %X %06X %08X %X\n",
+        rec->cycle,
+        rec->orig_id,
+        rec->cmd,
+        rec->addr & 0xFFFFF,
+        rec->data,
+        rec->shared);
+}
+
+// Binary format helpers
+
+static int put_u16(uint8_t* out, uint16_t v) {
+    out[0] = (uint8_t)v;
+    out[1] = (uint8_t)(v >> 8);
+    return 2;
+}
+
+static int put_u32(uint8_t* out, uint32_t v) {
+    out[0] = (uint8_t)v;
+    out[1] = (uint8_t)(v >> 8);
+    out[2] = (uint8_t)(v >> 16);
+    out[3] = (uint8_t)(v >> 24);
+    return 4;
+}
+
+static int put_varint(uint8_t* out, uint32_t v) {
+    int len = 0;
+    while (v >= 0x80) {
+        out[len++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    out[len++] = (uint8_t)v;
+    return len;
+}
+
+static bool get_u8(FILE* file, uint8_t* v) {
+    int c = getc(file);
+    if (c == EOF) return false;
+    *v = (uint8_t)c;
+    return true;
+}
+
+static bool get_u16(FILE* file, uint16_t* v) {
+    uint8_t b[2];
+    if (fread(b, 1, 2, file) != 2) return false;
+    *v = (uint16_t)(b[0] | (b[1] << 8));
+    return true;
+}
+
+static bool get_u32(FILE* file, uint32_t* v) {
+    uint8_t b[4];
+    if (fread(b, 1, 4, file) != 4) return false;
+    *v = (uint32_t)b[0] | ((uint32_t)b[1] << 8) | ((uint32_t)b[2] << 16) | ((uint32_t)b[3] << 24);
+    return true;
+}
+
+static bool get_varint(FILE* file, uint32_t* v) {
+    uint32_t result = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        uint8_t b;
+        if (!get_u8(file, &b)) return false;
+        result |= (uint32_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+            *v = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+void core_trace_codec_init(CoreTraceCodec* codec) {
+    memset(codec, 0, sizeof(*codec));
+    codec->prev.cycle = -1;
+}
+
+void bus_trace_codec_init(BusTraceCodec* codec) {
+    memset(codec, 0, sizeof(*codec));
+    codec->prev.cycle = -1;
+}
+
+// PC state of inactive stages is never looked at, so only active stages are
+// compared (and only active stages are updated when decoding).
+static bool pcs_same(const CoreTraceRecord* prev, const CoreTraceRecord* rec) {
+    for (int s = 0; s < TRACE_STAGE_COUNT; s++) {
+        if ((rec->active & (1 << s)) && rec->pc[s] != prev->pc[s]) return false;
+    }
+    return true;
+}
+
+static bool pcs_shifted(const CoreTraceRecord* prev, const CoreTraceRecord* rec) {
+    for (int s = 1; s < TRACE_STAGE_COUNT; s++) {
+        if ((rec->active & (1 << s)) && rec->pc[s] != prev->pc[s - 1]) return false;
+    }
+    return true;
+}
+
+int encode_core_trace(CoreTraceCodec* codec, const CoreTraceRecord* rec, uint8_t* out) {
+    CoreTraceRecord* prev = &codec->prev;
+    uint8_t flags = rec->active & CORE_FLAG_ACTIVE_MASK;
+    int len = 1;
+
+    if (rec->cycle == prev->cycle + 1) flags |= CORE_FLAG_CYCLE_NEXT;
+    else len += put_varint(out + len, (uint32_t)rec->cycle);
+
+    if (pcs_same(prev, rec)) {
+        flags |= CORE_FLAG_PCS_SAME;
+    } else if (pcs_shifted(prev, rec)) {
+        flags |= CORE_FLAG_PCS_SHIFTED;
+        if (rec->active & 1) len += put_u16(out + len, rec->pc[0]);
+    } else {
+        for (int s = 0; s < TRACE_STAGE_COUNT; s++) {
+            if (rec->active & (1 << s)) len += put_u16(out + len, rec->pc[s]);
+        }
+    }
+
+    uint16_t changed = 0;
+    for (int r = 2; r < REGISTER_COUNT; r++) {
+        if (rec->regs[r] != prev->regs[r]) changed |= (uint16_t)(1 << r);
+    }
+    len += put_u16(out + len, changed);
+    for (int r = 2; r < REGISTER_COUNT; r++) {
+        if (changed & (1 << r)) len += put_u32(out + len, (uint32_t)rec->regs[r]);
+    }
+
+    out[0] = flags;
+
+    // Mirror the decoder: inactive stages keep their previous PC
+    uint16_t pc[TRACE_STAGE_COUNT];
+    for (int s = 0; s < TRACE_STAGE_COUNT; s++) {
+        pc[s] = (rec->active & (1 << s)) ? rec->pc[s] : prev->pc[s];
+    }
+    *prev = *rec;
+    memcpy(prev->pc, pc, sizeof(pc));
+    return len;
+}
+
+bool decode_core_trace(CoreTraceCodec* codec, FILE* file, CoreTraceRecord* rec) {
+    CoreTraceRecord* prev = &codec->prev;
+    CoreTraceRecord next = *prev;
+    uint8_t flags;
+    uint32_t v32;
+    uint16_t v16;
+
+    if (!get_u8(file, &flags)) return false;
+    next.active = flags & CORE_FLAG_ACTIVE_MASK;
+
+    if (flags & CORE_FLAG_CYCLE_NEXT) {
+        next.cycle = prev->cycle + 1;
+    } else {
+        if (!get_varint(file, &v32)) return false;
+        next.cycle = (int)v32;
+    }
+
+    if (flags & CORE_FLAG_PCS_SHIFTED) {
+        for (int s = 1; s < TRACE_STAGE_COUNT; s++) {
+            if (next.active & (1 << s)) next.pc[s] = prev->pc[s - 1];
+        }
+        if (next.active & 1) {
+            if (!get_u16(file, &v16)) return false;
+            next.pc[0] = v16;
+        }
+    } else if (!(flags & CORE_FLAG_PCS_SAME)) {
+        for (int s = 0; s < TRACE_STAGE_COUNT; s++) {
+            if (next.active & (1 << s)) {
+                if (!get_u16(file, &v16)) return false;
+                next.pc[s] = v16;
+            }
+        }
+    }
+
+    uint16_t changed;
+    if (!get_u16(file, &changed)) return false;
+    for (int r = 2; r < REGISTER_COUNT; r++) {
+        if (changed & (1 << r)) {
+            if (!get_u32(file, &v32)) return false;
+            next.regs[r] = (int32_t)v32;
+        }
+    }
+
+    *prev = next;
+    *rec = next;
+    return true;
+}
+
+int encode_bus_trace(BusTraceCodec* codec, const BusTraceRecord* rec, uint8_t* out) {
+    BusTraceRecord* prev = &codec->prev;
+    uint8_t flags = 0;
+    int len = 1;
+
+    if (rec->cycle == prev->cycle + 1) flags |= BUS_FLAG_CYCLE_NEXT;
+    else len += put_varint(out + len, (uint32_t)rec->cycle);
+
+    if (rec->orig_id == prev->orig_id && rec->cmd == prev->cmd &&
+        rec->addr == prev->addr && rec->shared == prev->shared) {
+        flags |= BUS_FLAG_HEADER_SAME;
+    } else {
+        out[len++] = (uint8_t)rec->orig_id;
+        out[len++] = (uint8_t)rec->cmd;
+        out[len++] = (uint8_t)rec->shared;
+        len += put_u32(out + len, rec->addr);
+    }
+
+    if (rec->data == prev->data) flags |= BUS_FLAG_DATA_SAME;
+    else len += put_u32(out + len, rec->data);
+
+    out[0] = flags;
+    *prev = *rec;
+    return len;
+}
+
+bool decode_bus_trace(BusTraceCodec* codec, FILE* file, BusTraceRecord* rec) {
+    BusTraceRecord* prev = &codec->prev;
+    BusTraceRecord next = *prev;
+    uint8_t flags, b;
+    uint32_t v32;
+
+    if (!get_u8(file, &flags)) return false;
+
+    if (flags & BUS_FLAG_CYCLE_NEXT) {
+        next.cycle = prev->cycle + 1;
+    } else {
+        if (!get_varint(file, &v32)) return false;
+        next.cycle = (int)v32;
+    }
+
+    if (!(flags & BUS_FLAG_HEADER_SAME)) {
+        if (!get_u8(file, &b)) return false;
+        next.orig_id = b;
+        if (!get_u8(file, &b)) return false;
+        next.cmd = b;
+        if (!get_u8(file, &b)) return false;
+        next.shared = b;
+        if (!get_u32(file, &next.addr)) return false;
+    }
+
+    if (!(flags & BUS_FLAG_DATA_SAME)) {
+        if (!get_u32(file, &next.data)) return false;
+    }
+
+    *prev = next;
+    *rec = next;
+    return true;
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include "general_utils.h"
+
+// Shared between the simulator and the offline converter (trace_conv/), so
+// the text written from a binary trace is exactly what log_core_trace() and
+// log_bus_trace() would have written directly.
+
+#define TRACE_LINE_MAX 256
+#define TRACE_STAGE_COUNT 5 // FETCH, DECODE, EXEC, MEM, WB
+
+typedef struct {
+    int cycle;
+    uint8_t active;                 // Bit s set when pipeline stage s holds an instruction
+    uint16_t pc[TRACE_STAGE_COUNT];
+    int32_t regs[REGISTER_COUNT];   // Only R2-R15 are traced
+} CoreTraceRecord;
+
+typedef struct {
+    int cycle;
+    int orig_id;
+    int cmd;
+    uint32_t addr;
+    uint32_t data;
+    int shared;
+} BusTraceRecord;
+
+int format_core_trace(char* line, const CoreTraceRecord* rec);
+int format_bus_trace(char* line, const BusTraceRecord* rec);
+
+// Binary (delta) trace format
+//
+// A binary trace starts with a 4 byte magic and is followed by one record per
+// traced cycle. Every field is relative to the previous record of the same
+// file, the codec structs below hold that "previous" state on both sides.
+//
+// Core record:
+//   u8 flags   bits 0-4: stage active mask
+//              bit 5   : PCS_SAME    (active stages kept their PC - stall)
+//              bit 6   : PCS_SHIFTED (stage s has the old PC of stage s-1)
+//              bit 7   : CYCLE_NEXT  (cycle = previous cycle + 1)
+//   varint cycle              (only if !CYCLE_NEXT)
+//   u16 pc per active stage   (only if neither PCS_SAME nor PCS_SHIFTED)
+//   u16 fetch pc              (only if PCS_SHIFTED and FETCH is active)
+//   u16 changed register mask (bits 2-15)
+//   u32 per changed register
+//
+// Bus record:
+//   u8 flags   bit 0: CYCLE_NEXT, bit 1: HEADER_SAME (id/cmd/addr/shared), bit 2: DATA_SAME
+//   varint cycle                              (only if !CYCLE_NEXT)
+//   u8 orig_id, u8 cmd, u8 shared, u32 addr   (only if !HEADER_SAME)
+//   u32 data                                  (only if !DATA_SAME)
+//
+// Multi-byte fields are little endian.
+
+#define CORE_TRACE_MAGIC "CTR1"
+#define BUS_TRACE_MAGIC "BTR1"
+#define TRACE_MAGIC_SIZE 4
+#define TRACE_RECORD_MAX 128
+
+typedef struct {
+    CoreTraceRecord prev;
+} CoreTraceCodec;
+
+typedef struct {
+    BusTraceRecord prev;
+} BusTraceCodec;
+
+void core_trace_codec_init(CoreTraceCodec* codec);
+void bus_trace_codec_init(BusTraceCodec* codec);
+
+int encode_core_trace(CoreTraceCodec* codec, const CoreTraceRecord* rec, uint8_t* out);
+int encode_bus_trace(BusTraceCodec* codec, const BusTraceRecord* rec, uint8_t* out);
+
+// Return false at end of file (or on a truncated record)
+bool decode_core_trace(CoreTraceCodec* codec, FILE* file, CoreTraceRecord* rec);
+bool decode_bus_trace(BusTraceCodec* codec, FILE* file, BusTraceRecord* rec);
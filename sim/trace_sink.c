@@ -0,0 +1,160 @@
+#include "trace_sink.h"
+
+static void writer_thread(void* arg) {
+    TraceWriter* writer = (TraceWriter*)arg;
+
+    sim_mutex_lock(&writer->lock);
+    while (true) {
+        while (writer->queue_head == NULL && !writer->stop) {
+            sim_cond_wait(&writer->cond, &writer->lock);
+        }
+        if (writer->queue_head == NULL) break; // stop requested and nothing left
+
+        TraceSink* sink = writer->queue_head;
+        writer->queue_head = sink->next_job;
+        if (writer->queue_head == NULL) writer->queue_tail = NULL;
+        sink->next_job = NULL;
+        sim_mutex_unlock(&writer->lock);
+
+        // The simulator never touches the in-flight buffer, so no lock is needed here.
+        fwrite(sink->flight_data, 1, sink->flight_len, sink->file);
+
+        sim_mutex_lock(&writer->lock);
+        sink->in_flight = false;
+        sim_cond_broadcast(&writer->cond);
+    }
+    sim_mutex_unlock(&writer->lock);
+}
+
+TraceWriter* trace_writer_create(void) {
+    TraceWriter* writer = (TraceWriter*)calloc(1, sizeof(TraceWriter));
+    if (!writer) return NULL;
+
+    sim_mutex_init(&writer->lock);
+    sim_cond_init(&writer->cond);
+    writer->threaded = sim_thread_create(&writer->thread, writer_thread, writer);
+    if (!writer->threaded) {
+        DEBUG_PRINT("trace_writer_create(): no writer thread, writing synchronously\n");
+    }
+    return writer;
+}
+
+void trace_writer_destroy(TraceWriter* writer) {
+    if (!writer) return;
+
+    if (writer->threaded) {
+        sim_mutex_lock(&writer->lock);
+        writer->stop = true;
+        sim_cond_broadcast(&writer->cond);
+        sim_mutex_unlock(&writer->lock);
+        sim_thread_join(writer->thread);
+    }
+    sim_cond_destroy(&writer->cond);
+    sim_mutex_destroy(&writer->lock);
+    free(writer);
+}
+
+// Wait until the writer released this sink's other buffer.
+static void wait_for_flight(TraceSink* sink) {
+    TraceWriter* writer = sink->writer;
+    if (!writer->threaded) return;
+
+    sim_mutex_lock(&writer->lock);
+    while (sink->in_flight) {
+        sim_cond_wait(&writer->cond, &writer->lock);
+    }
+    sim_mutex_unlock(&writer->lock);
+}
+
+// Hand the active buffer to the writer and continue in the other one.
+static void submit_buffer(TraceSink* sink) {
+    TraceWriter* writer = sink->writer;
+    if (sink->fill == 0) return;
+
+    if (!writer->threaded) {
+        fwrite(sink->buffer[sink->active], 1, sink->fill, sink->file);
+        sink->fill = 0;
+        return;
+    }
+
+    wait_for_flight(sink);
+
+    sim_mutex_lock(&writer->lock);
+    sink->flight_data = sink->buffer[sink->active];
+    sink->flight_len = sink->fill;
+    sink->in_flight = true;
+    sink->active = 1 - sink->active;
+    sink->fill = 0;
+    if (writer->queue_tail) writer->queue_tail->next_job = sink;
+    else writer->queue_head = sink;
+    writer->queue_tail = sink;
+    sim_cond_broadcast(&writer->cond);
+    sim_mutex_unlock(&writer->lock);
+}
+
+static TraceSink* open_sink(TraceWriter* writer, const char* path, const char* mode, long long length) {
+    if (!writer) return NULL;
+
+    FILE* file = fopen(path, mode);
+    if (!file) return NULL;
+
+    TraceSink* sink = (TraceSink*)calloc(1, sizeof(TraceSink));
+    if (sink) {
+        sink->buffer[0] = (char*)malloc(TRACE_SINK_BUFFER_SIZE);
+        sink->buffer[1] = (char*)malloc(TRACE_SINK_BUFFER_SIZE);
+    }
+    if (!sink || !sink->buffer[0] || !sink->buffer[1]) {
+        if (sink) {
+            free(sink->buffer[0]);
+            free(sink->buffer[1]);
+            free(sink);
+        }
+        fclose(file);
+        return NULL;
+    }
+    sink->writer = writer;
+    sink->file = file;
+    sink->length = length;
+    return sink;
+}
+
+TraceSink* trace_sink_open(TraceWriter* writer, const char* path) {
+    return open_sink(writer, path, "w", 0);
+}
+
+TraceSink* trace_sink_continue(TraceWriter* writer, const char* path, long long length) {
+    if (!writer || !sim_truncate_file(path, length)) return NULL;
+    return open_sink(writer, path, "a", length);
+}
+
+long long trace_sink_length(const TraceSink* sink) {
+    return sink ? sink->length : 0;
+}
+
+void trace_sink_write(TraceSink* sink, const char* data, size_t len) {
+    if (!sink) return;
+    sink->length += (long long)len;
+
+    if (sink->fill + len > TRACE_SINK_BUFFER_SIZE) {
+        submit_buffer(sink);
+    }
+    if (len > TRACE_SINK_BUFFER_SIZE) {
+        // Larger than a whole buffer: write it straight through, in order.
+        wait_for_flight(sink);
+        fwrite(data, 1, len, sink->file);
+        return;
+    }
+    memcpy(sink->buffer[sink->active] + sink->fill, data, len);
+    sink->fill += len;
+}
+
+void trace_sink_close(TraceSink* sink) {
+    if (!sink) return;
+
+    submit_buffer(sink);
+    wait_for_flight(sink);
+    fclose(sink->file);
+    free(sink->buffer[0]);
+    free(sink->buffer[1]);
+    free(sink);
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include "general_utils.h"
+#include "sim_thread.h"
+
+// Each trace file is opened once and filled through a pair of large buffers.
+// When one buffer is full it is handed to the background writer thread and the
+// simulator keeps formatting into the other one, so the per-cycle logging never
+// touches the file system directly.
+#define TRACE_SINK_BUFFER_SIZE (1 << 20)
+
+typedef struct TraceSink TraceSink;
+
+typedef struct {
+    SimMutex lock;
+    SimCond cond;       // Signalled when a job is queued or a buffer is released
+    SimThread thread;
+    bool threaded;      // false -> buffers are written synchronously
+    bool stop;
+    TraceSink* queue_head;
+    TraceSink* queue_tail;
+} TraceWriter;
+
+struct TraceSink {
+    TraceWriter* writer;
+    FILE* file;
+    char* buffer[2];
+    int active;         // Buffer currently being filled by the simulator
+    size_t fill;
+    bool in_flight;     // The other buffer is queued for (or being written by) the writer
+    const char* flight_data;
+    size_t flight_len;
+    TraceSink* next_job;
+    long long length;   // Bytes written to the file so far, buffered ones included
+};
+
+TraceWriter* trace_writer_create(void);
+void trace_writer_destroy(TraceWriter* writer);
+
+TraceSink* trace_sink_open(TraceWriter* writer, const char* path);
+// Continue path after its first length bytes (the rest is dropped), NULL if
+// the file is missing or shorter
+TraceSink* trace_sink_continue(TraceWriter* writer, const char* path, long long length);
+long long trace_sink_length(const TraceSink* sink);
+void trace_sink_write(TraceSink* sink, const char* data, size_t len);
+void trace_sink_close(TraceSink* sink);
@@ -0,0 +1,74 @@
+// Offline converter for binary traces written with --binary-trace.
+// Rebuilds the coreNtrace.txt / bustrace.txt text format exactly.
+//
+// usage: trace_conv <binary trace> <text trace> [<binary trace> <text trace> ...]
+
+#include "../sim/trace_format.h"
+
+static bool convert_trace(const char* in_path, const char* out_path) {
+    FILE* in = fopen(in_path, "rb");
+    if (!in) {
+        perror(in_path);
+        return false;
+    }
+
+    char magic[TRACE_MAGIC_SIZE];
+    if (fread(magic, 1, TRACE_MAGIC_SIZE, in) != TRACE_MAGIC_SIZE) {
+        printf("%s: not a binary trace\n", in_path);
+        fclose(in);
+        return false;
+    }
+    bool is_core = memcmp(magic, CORE_TRACE_MAGIC, TRACE_MAGIC_SIZE) == 0;
+    bool is_bus = memcmp(magic, BUS_TRACE_MAGIC, TRACE_MAGIC_SIZE) == 0;
+    if (!is_core && !is_bus) {
+        printf("%s: not a binary trace\n", in_path);
+        fclose(in);
+        return false;
+    }
+
+    FILE* out = fopen(out_path, "w");
+    if (!out) {
+        perror(out_path);
+        fclose(in);
+        return false;
+    }
+
+    char line[TRACE_LINE_MAX];
+    long records = 0;
+    if (is_core) {
+        CoreTraceCodec codec;
+        CoreTraceRecord rec;
+        core_trace_codec_init(&codec);
+        while (decode_core_trace(&codec, in, &rec)) {
+            fwrite(line, 1, (size_t)format_core_trace(line, &rec), out);
+            records++;
+        }
+    } else {
+        BusTraceCodec codec;
+        BusTraceRecord rec;
+        bus_trace_codec_init(&codec);
+        while (decode_bus_trace(&codec, in, &rec)) {
+            fwrite(line, 1, (size_t)format_bus_trace(line, &rec), out);
+            records++;
+        }
+    }
+
+    DEBUG_PRINT("%s: %ld records\n", in_path, records);
+
+    fclose(out);
+    fclose(in);
+    return true;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3 || (argc - 1) % 2 != 0) {
+        printf("usage: %s <binary trace> <text trace> [<binary trace> <text trace> ...]\n", argv[0]);
+        return 1;
+    }
+
+    int status = 0;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (!convert_trace(argv[i], argv[i + 1])) status = 1;
+    }
+    return status;
+}